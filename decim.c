@@ -0,0 +1,177 @@
+/*
+ * decim.c
+ *
+ * Created: Oct 2026
+ *
+ * Decimation of the oversampled ADC input, to be run on the second processor core (CORE1).
+ * The ADC converts the three channels in round robin at 375kSps, so 125kSps per channel.
+ * Each channel is decimated by DEC_RATIO = 8 to S_RATE, in three stages:
+ *
+ *   125kSps --> CIC, R=4, N=5 --> 31.25kSps --> Halfband, 63 taps --> 15.625kSps --> Droop compensation
+ *
+ * For the higher I/Q rates the CIC ratio is lowered, the halfband stays as it is:
+ *   31.25kSps: CIC R=2, the halfband takes 62.5kSps
+ *   62.5kSps:  no CIC, the halfband takes 125kSps, no droop compensation needed
+ * The filter response scales with the rate, so at 62.5kSps the passband is 0..27.6kHz.
+ *
+ * The CIC needs no multiplies. Its integrators wrap around in unsigned arithmetic, which is
+ * harmless since the output needs only log2(4095*R^N) = 22 bits.
+ * The first alias band of the CIC, around 31.25kHz, is attenuated by at least 55dB for output
+ * frequencies below 6.9kHz, the passband of the FFT engine.
+ * The halfband filter does the rest of the alias rejection, every other coefficient is 0 except
+ * the center one, and the others are symmetric: 16 multiplies per output sample.
+ * It passes 0..6.9kHz and stops 8.7..15.6kHz by 59dB (Kaiser window, beta 5.65).
+ * A halfband can not compensate the CIC droop, so a 3 tap FIR at the output rate does that:
+ * the passband of the chain is within +/-0.6dB up to 6.9kHz.
+ * At 31.25kSps the CIC alone rejects the band around 62.5kHz, by 45dB at the passband edge.
+ *
+ * DC is removed after the CIC, with a bias that is tracked per block: the mean of the block
+ * is low pass filtered, RC = 8 blocks. So the bias is constant within a block.
+ * The bias has DEC_BF fraction bits, at low CIC gain the integer part alone would stall a few
+ * LSB away from the true DC level.
+ * The output scale is 8x the ADC LSB, like the sum of 8 conversions that this replaces.
+ * The sum of the absolute impulse response of the chain is up to 1.95, so with the DC level
+ * off center a full range input can exceed 16 bits: the output saturates.
+ * See tests/test_decim.c for the measured response.
+ */
+
+#include "pico/stdlib.h"
+#include "pico/platform.h"
+
+#include "decim.h"
+
+
+/*
+ * Halfband coefficients in Q15, the odd taps from the center outwards, h[-k] = h[k]
+ * The center tap is 0.5, all even taps are 0.
+ */
+#define HB_LEN		63
+#define HB_MID		31
+#define HB_NTAP		16
+const int16_t hb_tap[HB_NTAP] = {10403, -3394,  1951, -1306,   930,  -680,   502,  -369,
+								   267,  -190,   131,   -87,    55,   -32,    17,    -7};
+
+/*
+ * Droop compensation, Q14: y[n] = -a*x[n] + (1+2a)*x[n-1] - a*x[n-2]
+ * The gain is 1 at DC and 1+4a at the output Nyquist frequency
+ * The value of a depends on the CIC ratio, per rate mode
+ */
+const int32_t comp_a[DEC_NRATE] = {1620, 1260, 0};
+
+/* Rate mode parameters */
+int     dec_r = DEC_R;															// CIC ratio
+int     dec_sh = DEC_N*2;														// log2 of CIC gain R^N
+int32_t dec_a = 1620, dec_b = 16384 + 2*1620;									// Droop compensation
+
+#define DEC_BF		8															// Fraction bits of the bias
+
+/* State per channel */
+typedef struct
+{
+	uint32_t integ[DEC_N];													// CIC integrators
+	uint32_t comb[DEC_N];													// CIC comb delays
+	int32_t  bias;															// DC level of the CIC output, DEC_BF fraction bits
+	int16_t  line[2*HB_LEN];												// Halfband delay line, stored twice
+	int      pos;															// Halfband delay line index
+	int32_t  x1, x2;														// Compensation delay line
+} dec_t;
+dec_t dec_ch[DEC_NCH];
+
+
+/*
+ * Initialize the filter states, with bias the expected DC level in ADC LSB.
+ * The rate selects the output rate S_RATE<<rate, see decim.h
+ */
+void dec_init(int bias, int rate)
+{
+	int c, k;
+
+	if ((rate<0)||(rate>=DEC_NRATE)) rate = 0;
+	dec_r = DEC_R>>rate;
+	dec_sh = DEC_N*(2-rate);
+	dec_a = comp_a[rate];
+	dec_b = 16384 + 2*dec_a;
+
+	for (c=0; c<DEC_NCH; c++)
+	{
+		for (k=0; k<DEC_N; k++)
+		{
+			dec_ch[c].integ[k] = 0;
+			dec_ch[c].comb[k] = 0;
+		}
+		dec_ch[c].bias = bias << (dec_sh+DEC_BF);								// CIC gain R^N
+		for (k=0; k<2*HB_LEN; k++)
+			dec_ch[c].line[k] = 0;
+		dec_ch[c].pos = 0;
+		dec_ch[c].x1 = 0; dec_ch[c].x2 = 0;
+	}
+}
+
+
+/*
+ * Decimate one block, see decim.h
+ * The channels are done one by one, to keep the state in registers as much as possible.
+ */
+void __not_in_flash_func(dec_block)(const volatile uint16_t *adc, int n, int16_t *out[DEC_NCH])
+{
+	int c, j, k, pos, r, sh, bf;
+	uint32_t i0, i1, i2, i3, i4, v, t;
+	int32_t x, y, sum, bias;
+	const volatile uint16_t *ap;
+	int16_t *d, *op;
+	dec_t *s;
+
+	r = dec_r; sh = dec_sh;
+	bf = DEC_BF-3;																// Bias to 8x CIC output
+	for (c=0; c<DEC_NCH; c++)
+	{
+		s = &dec_ch[c];
+		ap = adc + c;
+		op = out[c];
+		i0 = s->integ[0]; i1 = s->integ[1]; i2 = s->integ[2]; i3 = s->integ[3]; i4 = s->integ[4];
+		bias = s->bias;
+		pos = s->pos;
+		sum = 0;
+
+		for (j=0; j<2*n; j++)												// CIC outputs, two per output sample
+		{
+			// Integrators, at the ADC channel rate
+			for (k=0; k<r; k++)
+			{
+				i0 += *ap; i1 += i0; i2 += i1; i3 += i2; i4 += i3;
+				ap += DEC_NCH;
+			}
+
+			// Combs, at the decimated rate
+			v = i4;
+			t = v - s->comb[0]; s->comb[0] = v; v = t;
+			t = v - s->comb[1]; s->comb[1] = v; v = t;
+			t = v - s->comb[2]; s->comb[2] = v; v = t;
+			t = v - s->comb[3]; s->comb[3] = v; v = t;
+			t = v - s->comb[4]; s->comb[4] = v; v = t;
+			sum += (int32_t)v;
+
+			// Remove DC and scale to 8x ADC LSB, into the halfband delay line
+			x = (((int32_t)v<<3) - (bias>>bf) + ((1<<sh)>>1)) >> sh;
+			s->line[pos] = x; s->line[pos+HB_LEN] = x;
+			if (++pos >= HB_LEN) pos = 0;
+			if ((j & 1) == 0) continue;										// Halfband output on every second input
+
+			// Halfband, d[0] is the oldest and d[HB_LEN-1] the newest sample
+			d = &s->line[pos];
+			y = (int32_t)d[HB_MID] * 16384;
+			for (k=0; k<HB_NTAP; k++)
+				y += (int32_t)hb_tap[k] * (d[HB_MID-1-2*k] + d[HB_MID+1+2*k]);
+			y = (y + (1<<14)) >> 15;
+
+			// Droop compensation
+			x = (dec_b*s->x1 - dec_a*(y + s->x2) + (1<<13)) >> 14;
+			s->x2 = s->x1; s->x1 = y;
+			*op++ = (int16_t)((x > 32767) ? 32767 : ((x < -32768) ? -32768 : x));
+		}
+
+		s->integ[0] = i0; s->integ[1] = i1; s->integ[2] = i2; s->integ[3] = i3; s->integ[4] = i4;
+		s->pos = pos;
+		s->bias = bias + (int32_t)(((((int64_t)sum<<DEC_BF)/(2*n)) - bias) >> 3);	// Track DC, per block
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef __DECIM_H__
+#define __DECIM_H__
+/*
+ * decim.h
+ *
+ * Created: Oct 2026
+ *
+ * See decim.c for more information
+ */
+
+#define DEC_NCH		3					// Nr of channels, ADC round robin
+#define DEC_R		4					// CIC decimation ratio, for output rate S_RATE
+#define DEC_RATIO	(2*DEC_R)			// Total decimation, CIC and halfband, for output rate S_RATE
+#define DEC_N		5					// CIC order
+#define DEC_NRATE	3					// Output rates S_RATE, 2x and 4x, CIC ratio 4, 2 and 1
+
+/*
+ * Decimate one block of round-robin ADC conversions into n output samples per channel
+ * adc[] holds n*(DEC_RATIO>>rate)*DEC_NCH conversions, channels interleaved, with rate as set by dec_init()
+ * out[c][] receives the n output samples of channel c, DC removed, 8x the ADC LSB
+ */
+void dec_block(const volatile uint16_t *adc, int n, int16_t *out[DEC_NCH]);
+void dec_init(int bias, int rate);
+
+#endif
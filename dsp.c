@@ -23,11 +23,14 @@
 #include "hardware/irq.h"
 #include "hardware/timer.h"
 #include "hardware/clocks.h"
+#include "hardware/sync.h"
 
 #include "uSDR.h"
 #include "dsp.h"
 #include "hmi.h"
 #include "fix_fft.h"
+#include "decim.h"
+#include "prof.h"
 
 
 volatile bool     tx_enabled;												// TX branch active
@@ -45,6 +48,7 @@ volatile uint32_t dsp_overrun;												// Overrun counter
 #define DAC_BIAS	(DAC_RANGE/2)
 #define ADC_RANGE	4096
 #define ADC_BIAS	(ADC_RANGE/2)
+#define ADC_BLK		64					// Nr of samples per ADC DMA block at S_RATE, 4.1msec
 
 
 volatile uint16_t dac_iq, dac_audio;
@@ -52,91 +56,283 @@ volatile uint16_t dac_iq, dac_audio;
 
 /*** External Interfaces, mostly used by hmi.c ***/
 
+/*
+ * The setters below run on CORE0, and only place a request in the settings mailbox dsp_req.
+ * CORE1 takes a snapshot once per block, before processing, and derives its working settings 
+ * from it, see dsp_snapshot(). So nothing changes in the middle of a block.
+ * The mailbox is guarded by a sequence counter: CORE0 is the only writer, the counter is odd 
+ * while it writes and it changes with every update. CORE1 retries on the next block when the 
+ * counter was odd or has moved during the copy, neither core ever waits for the other.
+ * The fields of one setting, like both NCO offsets or the mode and offset of a channel, are
+ * written in one update, so the snapshot never holds half of it.
+ */
+typedef struct
+{
+	int mode;
+	int flank;
+	int agc;
+	int vox;
+	int rate;
+	int iq;
+	int nr;
+	int notch;
+	int nco[2];
+	int chan_mode[CHAN_MAX];
+	int chan_off[CHAN_MAX];
+} dsp_set_t;
+volatile dsp_set_t dsp_req = {MODE_USB, FLANK_DEFAULT, AGC_NONE, VOX_OFF, RATE_15, IQ_ADAPT, NR_OFF, 0, {0, 0},
+							  {CHAN_OFF, CHAN_OFF, CHAN_OFF, CHAN_OFF}, {0, 0, 0, 0}};	// Requested settings
+volatile uint32_t  dsp_seq = 0;												// Sequence counter of dsp_req
+
+static void dsp_put(volatile int *field, int value)
+{
+	if (*field == value) return;											// No change, no update
+	dsp_seq++;																// Odd: update in progress
+	__dmb();
+	*field = value;
+	__dmb();
+	dsp_seq++;																// Even: done
+}
+
+// Two fields of one setting, in the same update so CORE1 never takes one without the other
+static void dsp_put2(volatile int *field0, int value0, volatile int *field1, int value1)
+{
+	if ((*field0 == value0) && (*field1 == value1)) return;
+	dsp_seq++;
+	__dmb();
+	*field0 = value0;
+	*field1 = value1;
+	__dmb();
+	dsp_seq++;
+}
+
+
 /*
  * MODE is modulation/demodulation 
  * This setting steers the signal processing branch chosen
  */
-volatile int dsp_mode;
+int dsp_mode = MODE_USB;													// CORE1 working setting
 void dsp_setmode(int mode)
 {
-	dsp_mode = mode;
-}
-
-
-/*
- * S-Meter is based on RSSI, which is in fact the signal level in the preprocessor.
- * The length of the (I,Q) vector is taken as reference for RSSI, where
- * S value is highest bit set, i.e. RSSI of 512 corresponds with S-9 (S=log2(RSSI))
- * This value was calibrated roughly by using the sam antenna and 
- *   comparing an IC R71-E with my uSDR HW implementation and ADC_INT=8.
- * +20dB means 10x the S-9 RSSI level, or >5120
- * +40dB means 100x the S-9 RSSI level, or >51200
- */
-#define S940	51200
-#define S930	16180
-#define S920	5120
-#define S910	1618
-#define S9		512
-#define S8		256
-#define S7		128
-#define S6		64
-#define S5		32
-#define S4		16
-#define S3		8
-#define S2		4
-#define S1		2
-volatile uint32_t s_rssi;													// 1.. >51200
+	dsp_put(&dsp_req.mode, mode);
+}
+
+
+/*
+ * FLANK is the width of the bandpass filter edges, in FFT bins
+ * Only used in the frequency domain branch
+ */
+int dsp_flank = FLANK_DEFAULT;												// CORE1 working setting
+void dsp_setflank(int flank)
+{
+	if ((flank >= FLANK_MIN) && (flank <= FLANK_MAX))
+		dsp_put(&dsp_req.flank, flank);
+}
+
+
+/*
+ * S-Meter is based on the signal power in the receiver passband, measured by the RX branch per 
+ * block, see smtr_update(). The levels are kept in 0.1dB relative to ADC full scale (dBFS), and 
+ * converted to dBm here, on CORE0, with a calibration that depends on the BPF and the attenuator.
+ * SMTR_CAL is the base: S-9 (-73dBm) corresponds to a carrier of 512x ADC LSB, like the previous 
+ * RSSI based S-Meter, calibrated roughly against an IC R71-E with the same antenna.
+ * The BPF offsets are measured corrections, zero until calibrated.
+ * S-units are 6dB apart, above S-9 the scale is in steps of 10dB: S-9+40dB shows as 94.
+ */
+#define SMTR_CAL	(-429)													// 0.1dBm at 0dBFS
+#define SMTR_S9		(-730)													// 0.1dBm
+int16_t smtr_cal_bpf[5] = {0, 0, 0, 0, 0};									// Per BPF relay bit, REL_LPF2 .. REL_BPF40
+int16_t smtr_cal_att[5] = {0, 200, 100, 300, -100};							// Per attenuator relay value, REL_ATT_00 .. REL_PRE_10
+int32_t smtr_cal = SMTR_CAL;												// Calibration in use
+volatile int32_t smtr_pk, smtr_av, smtr_nf;									// Passband peak and average, noise floor, 0.1dBFS
+
+/* 
+ * Select the calibration, with band and attn the relay values, see relay.h 
+ */
+void dsp_setcal(int band, int attn)
+{
+	int b;
+	
+	b = (band > 0) ? __builtin_ctz(band) : 0;
+	if (b > 4) b = 4;
+	if ((attn < 0) || (attn > 4)) attn = 0;
+	smtr_cal = SMTR_CAL + smtr_cal_bpf[b] + smtr_cal_att[attn];
+}
+
+/*
+ * Calibrated level in 0.1dBm, which is SMTR_PEAK, SMTR_AVG or SMTR_FLOOR
+ */
+int dsp_getlevel(int which)
+{
+	switch (which)
+	{
+	case SMTR_PEAK:  return smtr_pk + smtr_cal;
+	case SMTR_FLOOR: return smtr_nf + smtr_cal;
+	default:         return smtr_av + smtr_cal;
+	}
+}
+
 int get_sval(void)
 {
-	uint32_t s_val = s_rssi;
-	if (s_val>S940) return(94);												// Return max 2 digits!
-	if (s_val>S930) return(93);
-	if (s_val>S920) return(92);
-	if (s_val>S910) return(91);
-	if (s_val>S9)   return(9);
-	if (s_val>S8)   return(8);
-	if (s_val>S7)   return(7);
-	if (s_val>S6)   return(6);
-	if (s_val>S5)   return(5);
-	if (s_val>S4)   return(4);
-	if (s_val>S3)   return(3);
-	if (s_val>S2)   return(2);
-	return(1);
-}
-
-/*
- * AGC reference level is log2(0x40) = 6, where 0x40 is the MSB of half DAC_RANGE
- * 1/AGC_DECAY and 1/AGC_ATTACK are multipliers before agc_gain value integrator
- * These values should ultimately be set by the HMI.
- * The time it takes to a gain change is the ( (Set time)/(signal delta) ) / samplerate
- * So when delta is 1, and attack is 64, the time is 64/15625 = 4msec (fast attack)
- * The decay time is about 100x this value
- * Slow attack would be about 4096
-
- */
-#define AGC_REF		6
-#define AGC_DECAY	8192
-#define AGC_SHORT	64
-#define AGC_LONG	4096
-#define AGC_DIS		32766
-volatile uint16_t agc_decay  = AGC_DIS;
-volatile uint16_t agc_attack = AGC_DIS;
+	int p, k;
+	
+	p = dsp_getlevel(SMTR_PEAK);
+	if (p > SMTR_S9)
+	{
+		k = (p - SMTR_S9)/100;												// S-9 plus 10dB steps
+		return (k == 0) ? 9 : ((k > 4) ? 94 : 90+k);						// Return max 2 digits!
+	}
+	k = 8 - (SMTR_S9 - p)/60;
+	return (k < 1) ? 1 : k;
+}
+
+/*
+ * RATE is the I/Q sample rate, S_RATE<<rate, see dsp.h
+ * The decimator output rate follows, and the demodulator brings it back to the audio rate:
+ * the FFT engine processes a frame at the I/Q rate, and folds the shifted bins into an inverse of
+ * FFT_SIZE>>rate points, fix_fft_n(), that runs at S_RATE. At RATE_15 this is FFT_SIZE/2 points at
+ * S_RATE/2, followed by a halfband interpolator.
+ * The time domain engine filters and decimates the I/Q samples before demodulation.
+ * A new rate is applied by the DSP loop between two blocks, see dsp_rate_apply().
+ * In the FFT case a DMA block of ADC_BLK<<rate samples must fit in the queue buffer, see RATE_MAX.
+ */
+#if DSP_FFT == 1
+#define IQ_BLK(r)		BUFSIZE												// I/Q samples per block
+#define A_BLK(r)		(BUFSIZE>>(r))										// Audio samples per block
+#define RATE_MAX		((BUFSIZE >= (ADC_BLK<<RATE_62)) ? RATE_62 : (BUFSIZE >= (ADC_BLK<<RATE_31)) ? RATE_31 : RATE_15)
+#else
+#define IQ_BLK(r)		(BUFSIZE<<(r))
+#define A_BLK(r)		BUFSIZE
+#define RATE_MAX		RATE_62
+#endif
+volatile int dsp_rate    = RATE_15;											// Rate in use
+volatile int dsp_iqblk   = IQ_BLK(RATE_15);									// Block sizes for the rate in use
+volatile int dsp_ablk    = A_BLK(RATE_15);
+
+void dsp_setrate(int rate)
+{
+	if ((rate >= RATE_15) && (rate <= RATE_MAX))
+		dsp_put(&dsp_req.rate, rate);
+}
+
+int dsp_getrate(void)
+{
+	return dsp_rate;
+}
+
+
+/*
+ * IQ is the I/Q imbalance correction mode, see iq_balance()
+ */
+int dsp_iq = IQ_ADAPT;														// CORE1 working setting
+void dsp_setiq(int iq)
+{
+	if ((iq >= IQ_OFF) && (iq <= IQ_FREEZE))
+		dsp_put(&dsp_req.iq, iq);
+}
+
+
+/*
+ * NR is the noise reduction strength, see dsp_nrbins() in dsp_fft.c
+ */
+int dsp_nr = NR_OFF;														// CORE1 working setting
+void dsp_setnr(int nr)
+{
+	if ((nr >= NR_OFF) && (nr <= NR_HIGH))
+		dsp_put(&dsp_req.nr, nr);
+}
+
+
+/*
+ * NOTCH switches the automatic notch on (1) or off (0), see dsp_autonotch() in dsp_fft.c
+ */
+int dsp_notch = 0;															// CORE1 working setting
+void dsp_setnotch(int on)
+{
+	dsp_put(&dsp_req.notch, (on != 0));
+}
+
+
+/*
+ * NCO is the fine tuning offset in Hz of the RX and the TX signal, relative to the LO frequency 
+ * plus FC_OFFSET, see nco_iq(). It is clipped to the window of the requested rate.
+ */
+void dsp_setnco(int rx, int tx)
+{
+	int w;
+	
+	w = NCO_WIN(dsp_req.rate);
+	dsp_put2(&dsp_req.nco[0], MIN(w, MAX(-w, rx)), &dsp_req.nco[1], MIN(w, MAX(-w, tx)));
+}
+
+
+/*
+ * CHAN sets up an extra receiver channel, demodulated from the same spectrum as the main 
+ * receiver, and mixed into the audio output, see chan_rx() in dsp_fft.c
+ * The offset in Hz is relative to the tuned frequency, CHAN_OFF switches the channel off.
+ */
+int dsp_chan[CHAN_MAX] = {CHAN_OFF, CHAN_OFF, CHAN_OFF, CHAN_OFF};			// CORE1 working setting, mode
+int dsp_choff[CHAN_MAX] = {0, 0, 0, 0};										// CORE1 working setting, offset
+volatile int chan_lvl[CHAN_MAX] = {-1200, -1200, -1200, -1200};			// Passband levels, 0.1dBFS
+void dsp_setchan(int c, int mode, int offset)
+{
+	if ((c < 0) || (c >= CHAN_MAX) || (mode < CHAN_OFF) || (mode > MODE_CW)) return;
+	dsp_put2(&dsp_req.chan_mode[c], mode, &dsp_req.chan_off[c], offset);
+}
+
+int dsp_getchan(int c)
+{
+	return ((c < 0) || (c >= CHAN_MAX)) ? 0 : chan_lvl[c] + smtr_cal;
+}
+
+
+
+/*
+ * AGC runs once per block on the demodulated signal, in the log2 domain, see dsp_agc().
+ * Levels and gains are log2 values in Q16, so 1<<16 is a factor 2 (6dB).
+ * AGC_REF is the reference for the output peak, log2(90) = 6.5, where DAC_BIAS is 128
+ * The gain is kept between AGC_GMIN and AGC_GMAX, and is AGC_GFIX when AGC is off.
+ * The time constants are converted to blocks of dsp_ablk audio samples, BLK_US per block:
+ * - attack: the fraction (Q8) of the gain excess that is removed per block
+ * - hang:   the number of blocks that the gain is held after an attack
+ * - decay:  the gain increase per block, from a rate in dB/sec
+ */
+#define BLK_US			(dsp_ablk*TIM_US)									// Block time in usec, depends on rate
+#define AGC_ATT(ms)		MIN(256, (256*BLK_US)/((ms)*1000))					// Attack time constant
+#define AGC_HANG(ms)	(((ms)*1000)/BLK_US)								// Hang time
+#define AGC_DEC(dbs)	((((dbs)*BLK_US)/1000)*65536/6020)					// Decay rate
+#define AGC_REF			((13<<16)/2)
+#define AGC_GMAX		(5<<16)
+#define AGC_GMIN		(-(12<<16))
+#define AGC_GFIX		(-(4<<16))
+int32_t agc_attack = 0;														// 0: AGC off
+int32_t agc_hang   = 0;
+int32_t agc_decay  = 0;
 
 void dsp_setagc(int agc)
+{
+	dsp_put(&dsp_req.agc, agc);
+}
+
+// CORE1: derive the AGC constants, also after a change of block time
+static void agc_derive(int agc)
 {
 	switch(agc)
 	{
 	case AGC_SLOW:
-		agc_attack = AGC_LONG;
-		agc_decay  = AGC_DECAY;
+		agc_attack = AGC_ATT(40);
+		agc_hang   = AGC_HANG(800);
+		agc_decay  = AGC_DEC(5);
 		break;
 	case AGC_FAST:
-		agc_attack = AGC_SHORT;
-		agc_decay  = AGC_DECAY;
+		agc_attack = AGC_ATT(4);
+		agc_hang   = AGC_HANG(100);
+		agc_decay  = AGC_DEC(20);
 		break;
 	default:
-		agc_attack = AGC_DIS;
-		agc_decay  = AGC_DIS;
+		agc_attack = 0;
+		agc_hang   = 0;
+		agc_decay  = 0;
 		break;
 	}
 }
@@ -149,10 +345,16 @@ void dsp_setagc(int agc)
  */
 #define VOX_LINGER		500													// 500msec
 
-volatile uint16_t vox_count = 0;
-volatile uint16_t vox_level = 0;
+int32_t           vox_count = 0;
+uint16_t          vox_level = 0;
 volatile bool	  vox_active;												// Is set when audio energy > vox level (and not OFF)
 void dsp_setvox(int vox)
+{
+	dsp_put(&dsp_req.vox, vox);
+}
+
+// CORE1: derive the VOX level
+static void vox_derive(int vox)
 {
 	switch(vox)
 	{
@@ -210,37 +412,545 @@ inline int16_t mag(int16_t i, int16_t q)
  * Also, for RC value 1/a = 1<<b, or RC = ((1<<b)-1)*64us
  */
 
+/*
+ * Fixed point log2 and exp2, in Q16, by table lookup with linear interpolation.
+ * The tables hold log2(1+k/16) in Q16 and 2^(k/16) in Q14, for k = 0..16.
+ */
+const int32_t log2_tab[17] = {    0,  5732, 11136, 16248, 21098, 25711, 30109, 34312, 38336, 
+							  42196, 45904, 49472, 52911, 56229, 59434, 62534, 65536};
+const int32_t exp2_tab[17] = {16384, 17109, 17867, 18658, 19484, 20347, 21247, 22188, 23170, 
+							  24196, 25268, 26386, 27554, 28774, 30048, 31379, 32768};
+
+// x > 0, returns log2(x) in Q16
+int32_t __not_in_flash_func(log2_q16)(uint32_t x)
+{
+	int n, k;
+	uint32_t f;
+	
+	n = 31 - __builtin_clz(x);												// Integer part
+	f = (n > 16) ? (x >> (n-16)) : (x << (16-n));							// Mantissa in Q16, 1.0 .. 2.0
+	k = (f >> 12) & 15;														// Table index, 16 segments
+	f &= 0x0fff;															// Remainder within segment
+	return (n<<16) + log2_tab[k] + (((log2_tab[k+1]-log2_tab[k])*f) >> 12);
+}
+
+// Returns 2^frac(g) in Q14 in *mant, and a right shift 1..31 in *rs, so 2^g ~ *mant >> *rs
+void __not_in_flash_func(exp2_q16)(int32_t g, int32_t *mant, int *rs)
+{
+	int k, f, n;
+	
+	k = (g >> 12) & 15; 
+	f = g & 0x0fff;
+	*mant = exp2_tab[k] + (((exp2_tab[k+1]-exp2_tab[k])*f) >> 12);
+	n = 14 - (g >> 16);														// Floor of g, negative g too
+	*rs = (n < 1) ? 1 : ((n > 31) ? 31 : n);
+}
+#define AGC_MUL(x, mant, rs)	(((int32_t)(x)*(mant) + (1<<((rs)-1))) >> (rs))
+#define DAC_CLIP(x)				( (x)<0 ? 0 : ((x)>DAC_RANGE-1 ? DAC_RANGE-1 : (x)) )
+
+
+/*** AGC engine ***/
+
+/*
+ * This is called once per block by the RX branch, with the peak magnitude of the demodulated block 
+ * before output, and exp the log2 of the block scale factor, e.g. FFT scaling.
+ * It returns the log2 gain in Q16 to apply to the block samples, exp included.
+ * - target: the gain that puts the block peak on AGC_REF
+ * - attack: when target is below the gain, the gain moves a fraction agc_attack/256 towards it,
+ *   and the hang counter is restarted
+ * - hang:   while the counter runs the gain is held
+ * - decay:  then the gain rises by agc_decay per block, up to target
+ * The block is processed before it is output, so the engine looks ahead one block:
+ * the gain applied never exceeds the target of the block itself, even with slow attack.
+ * A short peak is thus handled without clipping, while a slow attack keeps the gain for the
+ * surrounding signal.
+ */
+volatile int32_t agc_gain = AGC_GFIX;										// Current gain, log2 in Q16
+volatile int32_t agc_hold = 0;												// Hang counter, in blocks
+int32_t __not_in_flash_func(dsp_agc)(uint32_t peak, int exp)
+{
+	int32_t target, g;
+	
+	if (agc_attack == 0)													// AGC off
+		return AGC_GFIX + (exp<<16);
+	
+	target = AGC_REF - log2_q16(peak|1) - (exp<<16);						// Gain for peak at reference
+	if (target > AGC_GMAX) target = AGC_GMAX;
+	if (target < AGC_GMIN) target = AGC_GMIN;
+	
+	g = agc_gain;
+	if (target < g)															// Attack
+	{
+		g -= ((g - target)*agc_attack) >> 8;
+		agc_hold = agc_hang;
+	}
+	else if (agc_hold > 0)													// Hang
+		agc_hold--;
+	else																	// Decay
+	{
+		g += agc_decay;
+		if (g > target) g = target;
+	}
+	agc_gain = g;
+	
+	if (g > target) g = target;												// Look-ahead
+	return g + (exp<<16);
+}
+
+
+
+/*** S-meter levels ***/
+
+/*
+ * This is called once per RX block by the engine, with the log2 in Q16 of the mean power per 
+ * sample relative to full scale, for the passband (pass) and for the noise in the passband (floor).
+ * Full scale is a complex carrier of amplitude 8x ADC_BIAS, the decimator output scale.
+ * When the engine has no noise estimate, floor is SMTR_NONE and the floor tracks the minimum of the
+ * passband level instead, rising by SMTR_RISE.
+ * - peak:    follows the block level up immediately, decays by SMTR_DECAY
+ * - average: low pass, time constant SMTR_TAV
+ * The state is in Q8 of 0.1dB, the published levels are 0.1dBFS, CORE0 reads them as they are.
+ */
+#define SMTR_NONE		INT32_MIN
+#define SMTR_FS			(28<<16)											// Log2 Q16 of full scale power, (8*ADC_BIAS)^2
+#define SMTR_DB(l)		((((l)>>6)*1927)>>16)								// Log2 Q16 to 0.1dB, 10*log10(2)
+#define SMTR_TAV		300000												// usec
+#define SMTR_DECAY		200													// 0.1dB per second, i.e. 20dB/s
+#define SMTR_RISE		30													// 0.1dB per second, i.e. 3dB/s
+int32_t smtr_pk8 = -1200*256, smtr_av8 = -1200*256, smtr_nf8 = -1200*256;	// Levels in Q8 of 0.1dB
+
+/* Log2 in Q16 of a 64 bit value */
+static int32_t log2_q16_64(uint64_t x)
+{
+	int k;
+	
+	if ((x >> 32) == 0) return log2_q16((uint32_t)x | 1);
+	k = 32 - __builtin_clz((uint32_t)(x >> 32));
+	return log2_q16((uint32_t)(x >> k)) + (k<<16);
+}
+
+void __not_in_flash_func(smtr_update)(int32_t pass, int32_t floor)
+{
+	int32_t l, n, a;
+	
+	l = SMTR_DB(pass - SMTR_FS) * 256;
+	a = (BLK_US<<12)/SMTR_TAV;												// Averaging step, Q12
+	smtr_av8 += ((int64_t)(l - smtr_av8)*a) >> 12;
+	smtr_pk8 -= (int32_t)((SMTR_DECAY*256*(int64_t)BLK_US)/1000000);		// 64 bit, BLK_US is up to 131msec
+	if (l > smtr_pk8) smtr_pk8 = l;
+	if (floor == SMTR_NONE)
+	{
+		smtr_nf8 += (int32_t)((SMTR_RISE*256*(int64_t)BLK_US)/1000000);
+		if (smtr_av8 < smtr_nf8) smtr_nf8 = smtr_av8;
+	}
+	else
+	{
+		n = SMTR_DB(floor - SMTR_FS) * 256;
+		smtr_nf8 += ((int64_t)(n - smtr_nf8)*a) >> 12;
+	}
+	smtr_pk = smtr_pk8 >> 8;
+	smtr_av = smtr_av8 >> 8;
+	smtr_nf = smtr_nf8 >> 8;
+}
+
+
+
+/*** Load shedding ***/
+
+/*
+ * The processing time of each block is measured against the block time BLK_US, as dsp_load in Q8.
+ * When it exceeds SHED_HI, optional stages are dropped one level per block, in the order of the 
+ * levels below. A block that misses its deadline drops them all at once.
+ * When the load stays below SHED_LO for SHED_HOLD msec, one level is restored. The hold also 
+ * keeps a restored stage from being dropped again right away when it does not fit.
+ * The engines test dsp_shed, a stage runs when dsp_shed is below its level.
+ */
+#define SHED_NONE		0													// All stages run
+#define SHED_NR			1													// No noise reduction and auto-notch
+#define SHED_MASK		2													// Bandpass mask without flanks
+#define SHED_SPEC		3													// No spectrum export
+#define SHED_MAX		SHED_SPEC
+#define SHED_HI			((90*256)/100)										// Load thresholds, Q8
+#define SHED_LO			((65*256)/100)
+#define SHED_HOLD		2000												// msec
+volatile int      dsp_shed = SHED_NONE;										// Quality level, reported by monitor
+volatile uint32_t dsp_load = 0;												// Last block load, Q8
+int               shed_count = 0;											// Blocks below SHED_LO
+
+/*
+ * Update the level for a block that took us usec
+ */
+static void dsp_shedding(uint32_t us)
+{
+	uint32_t load;
+	
+	load = (us<<8)/BLK_US;
+	dsp_load = load;
+	if (load >= 256)														// Deadline missed
+	{
+		dsp_shed = SHED_MAX;
+		shed_count = 0;
+	}
+	else if (load > SHED_HI)												// Drop one more stage
+	{
+		if (dsp_shed < SHED_MAX) dsp_shed++;
+		shed_count = 0;
+	}
+	else if (load < SHED_LO)												// Restore one stage, after hold
+	{
+		if ((dsp_shed > SHED_NONE) && (++shed_count >= (SHED_HOLD*1000)/BLK_US))
+		{
+			dsp_shed--;
+			shed_count = 0;
+		}
+	}
+	else
+		shed_count = 0;
+}
+
+
+
+/*** Spectrum export ***/
+
+/*
+ * Ring of SPEC_NFRM spectrum frames, CORE1 is the only producer and CORE0 the only consumer.
+ * spec_head is only written by CORE1 and spec_tail only by CORE0, both count frames and wrap freely.
+ * CORE1 fills the slot at spec_head, and advances spec_head behind a memory barrier.
+ * When the ring is full the new frame is dropped and counted, CORE1 never waits for CORE0.
+ * CORE0 takes the newest frame, the slot before spec_head, and then moves spec_tail up to 
+ * spec_head, see dsp_getspec(). This is safe with one writer per index: while spec_tail is 
+ * behind that slot, CORE1 can fill at most the SPEC_NFRM-1 slots after it.
+ * A frame is stale when newer frames were dropped, after the ring was full while CORE0 did not 
+ * read. Its number is then more than SPEC_AGE behind spec_seq: it is not returned, but the ring 
+ * is emptied, so the next block fills it again.
+ */
+#define SPEC_NFRM		4													// Power of 2
+#define SPEC_AGE		2													// Blocks, the one in progress and the last one
+spec_frame_t      spec_ring[SPEC_NFRM];
+volatile uint32_t spec_head = 0, spec_tail = 0;
+volatile uint32_t spec_seq = 0, spec_drop = 0;								// Frames produced and dropped
+
+// CORE1: the slot to fill, or NULL when the ring is full
+spec_frame_t *spec_slot(void)
+{
+	spec_seq++;
+	if (spec_head - spec_tail >= SPEC_NFRM)
+	{
+		spec_drop++;
+		return NULL;
+	}
+	return &spec_ring[spec_head & (SPEC_NFRM-1)];
+}
+
+// CORE1: publish the filled slot
+void spec_commit(void)
+{
+	__dmb();
+	spec_head++;
+}
+
+bool dsp_getspec(spec_frame_t *f)
+{
+	uint32_t h;
+	
+	h = spec_head;
+	if (h == spec_tail) return false;
+	__dmb();
+	*f = spec_ring[(h-1) & (SPEC_NFRM-1)];
+	__dmb();
+	spec_tail = h;
+	return (spec_seq - f->seq <= SPEC_AGE);
+}
+
+
+
+/*** DAC output blocks ***/
+
+/*
+ * The DACs are PWM slices, of which the compare registers are written by DMA at the I/Q rate and S_RATE.
+ * Each DAC has two output blocks of dsp_iqblk or dsp_ablk samples: one is played while the DSP engine 
+ * writes the other, once per DSP loop. The blocks swap when the sample queues wrap, see dma_handler().
+ * I and Q share a slice, so one 32 bit word holds both compare values: I in channel B, Q in channel A.
+ * The audio DAC is channel A of its slice, a 16 bit write is replicated to both channels.
+ * Blocks are aligned on their largest size, so the DMA read address can wrap within a block.
+ */
+#define CH2			2														// DMA channels for the I/Q output blocks
+#define CH3			3
+#define CH4			4														// DMA channels for the audio output blocks
+#define CH5			5
+#define DAC_TMR_IQ	0														// DMA pacing timers
+#define DAC_TMR_A	1
+#define DAC_IQ(i,q)	(((uint32_t)(i)<<16) | (uint32_t)(q))					// Compare register value, I on B and Q on A
+uint32_t dac_iqbuf[2][IQSIZE] __attribute__((aligned(4*IQSIZE)));			// I/Q DAC output blocks
+uint16_t dac_abuf[2][BUFSIZE] __attribute__((aligned(2*BUFSIZE)));			// Audio DAC output blocks
+volatile int  dac_play = 0;													// Output block being played by DMA
+volatile bool dac_run = false;												// Output DMA started
+
+// Sample queue indexes, updated by the block handler
+volatile int      dsp_active = 0;											// I, Q, A active buffer number (0..2)
+volatile uint32_t dsp_tick   = 0;											// Index in active buffer, per ADC_BLK
+volatile uint32_t dsp_tickx  = 0;											// Load indicator DSP loop
+
+/*
+ * The DMA keeps playing the blocks of the idle DACs, so set these to bias
+ * iq: true for the I/Q DACs, false for the audio DAC
+ */
+void dac_mute(bool iq)
+{
+	int i;
+	
+	if (iq)
+		for (i=0; i<IQSIZE; i++)
+			{ dac_iqbuf[0][i] = DAC_IQ(DAC_BIAS, DAC_BIAS); dac_iqbuf[1][i] = DAC_IQ(DAC_BIAS, DAC_BIAS); }
+	else
+		for (i=0; i<BUFSIZE; i++)
+			{ dac_abuf[0][i] = DAC_BIAS; dac_abuf[1][i] = DAC_BIAS; }
+}
+
+/*
+ * Configure DMA channels CH2..CH5 for the DACs, chained in pairs: CH2/CH3 for I/Q and CH4/CH5 for audio
+ * Each plays one output block into the PWM compare register, paced by a DMA timer at the I/Q rate or S_RATE.
+ * The read address wraps within the block and the transfer count is reloaded when the channel 
+ * is triggered by its partner, so the channels never need to be re-armed.
+ * The pairs are started by the block handler, on the first wrap of the sample queues.
+ */
+void dac_config(void)
+{
+	int i;
+
+	dma_timer_set_fraction(DAC_TMR_IQ, 1, clock_get_hz(clk_sys)/(S_RATE<<dsp_rate));	// 125MHz/8000 = 15625Hz
+	dma_timer_set_fraction(DAC_TMR_A, 1, clock_get_hz(clk_sys)/S_RATE);
+	for (i=CH2; i<=CH5; i++)
+	{
+		dma_channel_config c = dma_channel_get_default_config(i);
+		if (i < CH4)
+		{
+			channel_config_set_transfer_data_size(&c, DMA_SIZE_32);			// Word for both I and Q compare values
+			channel_config_set_ring(&c, false, __builtin_ctz(dsp_iqblk*sizeof(uint32_t)));
+			channel_config_set_dreq(&c, dma_get_timer_dreq(DAC_TMR_IQ));
+		}
+		else
+		{
+			channel_config_set_transfer_data_size(&c, DMA_SIZE_16);			// Half word for the audio compare value
+			channel_config_set_ring(&c, false, __builtin_ctz(dsp_ablk*sizeof(uint16_t)));
+			channel_config_set_dreq(&c, dma_get_timer_dreq(DAC_TMR_A));
+		}
+		channel_config_set_read_increment(&c, true);						// Play the block
+		channel_config_set_write_increment(&c, false);						// Always write the compare register
+		channel_config_set_chain_to(&c, i^1);								// Continue with other block when done
+		if (i < CH4)
+			dma_channel_configure(i, &c, &pwm_hw->slice[dac_iq].cc, &dac_iqbuf[i-CH2][0], dsp_iqblk, false);
+		else
+			dma_channel_configure(i, &c, &pwm_hw->slice[dac_audio].cc, &dac_abuf[i-CH4][0], dsp_ablk, false);
+	}
+}
+
+
+
+/*** Fine tuning NCO ***/
+
+/*
+ * The NCO shifts the I/Q signal by the fine tuning offset, so small frequency steps and RIT/XIT 
+ * do not need the Si5351, see hmi_evaluate(). 
+ * RX: the newest I/Q queue buffer is shifted down by the offset in place, before the engine reads 
+ * it, so the FFT engine sees the tuned signal at FC_OFFSET like the time domain engine sees it at 0.
+ * TX: the I/Q DAC output block is shifted up by the offset, after the engine wrote it.
+ * The phase is a 32 bit accumulator per direction, so a new offset or the next block continue
+ * without a phase jump. It is reset when the offset is set to 0, which ends the rotation.
+ * Sine and cosine are taken from the FFT sine table, linearly interpolated on the phase bits below 
+ * the table index: the error is ~1e-5, below the Q15 resolution, so there are no phase spurs.
+ * Per sample this is 4 table reads and 6 multiplies, with an offset of 0 the block is skipped.
+ */
+#define NCO_SH		(32-FFT_ORDER)											// Phase bits below the table index
+int32_t  nco_step[2] = {0, 0};												// Phase step per I/Q sample, RX and TX
+uint32_t nco_ph[2]   = {0, 0};												// Phase, 2^32 per cycle
+
+// sin(2*pi*k/FFT_SIZE) in Q15, the table holds 3/4 of a period
+static inline int32_t tab_sin(int k)
+{
+	k &= FFT_SIZE-1;
+	return (k < 3*FFT_SIZE/4) ? fft_tab.sine[k] : -fft_tab.sine[k-FFT_SIZE/2];
+}
+
+static inline int32_t nco_sin(uint32_t ph)
+{
+	int k;
+	int32_t s0, f;
+	
+	k = ph >> NCO_SH;
+	f = (ph >> (NCO_SH-15)) & 0x7fff;										// Fraction in Q15
+	s0 = tab_sin(k);
+	return s0 + (((tab_sin(k+1) - s0)*f + 0x4000) >> 15);
+}
+
+/*
+ * Derive the phase steps from the offsets in Hz, after a change of offset or rate
+ * The offsets are within +/-fs/2, so the steps fit in 32 bits.
+ */
+static void nco_derive(int rx, int tx)
+{
+	int32_t fs;
+	int k;
+	
+	fs = S_RATE<<dsp_rate;
+	nco_step[0] = (int32_t)((int64_t)(-rx) * 4294967296LL / fs);			// RX: tuned signal down to FC_OFFSET
+	nco_step[1] = (int32_t)((int64_t)tx * 4294967296LL / fs);				// TX: FC_OFFSET up to the tuned signal
+	for (k=0; k<2; k++)
+		if (nco_step[k] == 0) nco_ph[k] = 0;								// No offset, no rotation
+}
+
+/*
+ * RX: rotate n I/Q queue samples in place
+ */
+void __not_in_flash_func(nco_iq)(int16_t *ip, int16_t *qp, int n)
+{
+	int k;
+	int32_t c, s, i, q, x;
+	uint32_t ph, step;
+	
+	ph = nco_ph[0]; step = nco_step[0];
+	if ((step == 0) && (ph == 0)) return;
+	for (k=0; k<n; k++)
+	{
+		c = nco_sin(ph + (1u<<30)); s = nco_sin(ph);
+		i = ip[k]; q = qp[k];
+		x = (i*c - q*s + 0x4000) >> 15;
+		ip[k] = (x > 32767) ? 32767 : ((x < -32768) ? -32768 : x);
+		x = (i*s + q*c + 0x4000) >> 15;
+		qp[k] = (x > 32767) ? 32767 : ((x < -32768) ? -32768 : x);
+		ph += step;
+	}
+	nco_ph[0] = ph;
+}
+
+/*
+ * TX: rotate n I/Q DAC output samples in place, around the DAC bias
+ */
+void __not_in_flash_func(nco_dac)(uint32_t *iqp, int n)
+{
+	int k;
+	int32_t c, s, i, q, x, y;
+	uint32_t ph, step;
+	
+	ph = nco_ph[1]; step = nco_step[1];
+	if ((step == 0) && (ph == 0)) return;
+	for (k=0; k<n; k++)
+	{
+		c = nco_sin(ph + (1u<<30)); s = nco_sin(ph);
+		i = (int32_t)(iqp[k] >> 16) - DAC_BIAS;
+		q = (int32_t)(iqp[k] & 0xffff) - DAC_BIAS;
+		x = ((i*c - q*s + 0x4000) >> 15) + DAC_BIAS;
+		y = ((i*s + q*c + 0x4000) >> 15) + DAC_BIAS;
+		iqp[k] = DAC_IQ(DAC_CLIP(x), DAC_CLIP(y));
+		ph += step;
+	}
+	nco_ph[1] = ph;
+}
+
 
 
 /*** Include the desired DSP engine ***/
 
 #if DSP_FFT == 1
-#define AGC_TOP		 2047L
 #include "dsp_fft.c"
 #else
-#define AGC_TOP		 2047L
 #include "dsp_tim.c"
 #endif
 
 
 
-/** CORE1: ADC IRQ handler **/
+/** CORE1: I/Q balance **/
 /*
- * The IRQ handling is redirected to a DMA channel
- * This will transfer ADC_INT samples per channel, ADC_INT maximum is 10 (would take 60usec) but safer to use 8
+ * The I and Q channels have separate analog paths, a gain or phase mismatch leaks the opposite
+ * sideband into the wanted one. This is corrected on Q, with I as reference:
+ *   Q' = Q + a*Q + b*I,  a and b in Q15
+ * The estimate is blind, it only assumes that the received signal is circular, i.e. on average
+ * I and Q have equal power and are uncorrelated. Both are measured on the corrected block:
+ * - b removes the correlation: b -= mu * E[I*Q']/E[I^2]
+ * - a equalizes the power:    a -= mu * (E[Q'^2]/E[I^2] - 1)/2
+ * with mu = 2^-IQ_MU, so the estimate settles in about 2^IQ_MU blocks, and blocks with too 
+ * little signal are skipped. The sums are 64 bit, the multiplies and the divisions only per block.
+ * The newest I/Q queue buffer is corrected in place, once, before the RX engine reads it.
+ * In IQ_FREEZE the last coefficients are applied, IQ_OFF resets them.
+ */
+#define IQ_MU		5														// Step size, 1/32
+#define IQ_LIM		8192													// Coefficient range, +/-0.25
+#define IQ_PMIN		64														// Minimum mean power, 8x ADC LSB squared
+volatile int32_t iq_a = 0, iq_b = 0;										// Correction coefficients, Q15
+
+void __not_in_flash_func(iq_block)(int16_t *ip, int16_t *qp, int n, bool adapt)
+{
+	int k;
+	int32_t a, b, i, q;
+	int64_t pi, pq, c;
+	
+	a = iq_a; b = iq_b;
+	pi = 0; pq = 0; c = 0;
+	for (k=0; k<n; k++)
+	{
+		i = ip[k];
+		q = qp[k];
+		q += (a*q + b*i + 0x4000) >> 15;
+		q = (q > 32767) ? 32767 : ((q < -32768) ? -32768 : q);
+		qp[k] = (int16_t)q;
+		pi += i*i;
+		pq += q*q;
+		c  += i*q;
+	}
+	if (!adapt || (pi < (int64_t)IQ_PMIN*n) || (pq < (int64_t)IQ_PMIN*n))
+		return;
+	b -= (int32_t)((c*32768)/pi) >> IQ_MU;
+	a -= (int32_t)(((pq-pi)*16384)/pi) >> IQ_MU;
+	iq_a = (a > IQ_LIM) ? IQ_LIM : ((a < -IQ_LIM) ? -IQ_LIM : a);
+	iq_b = (b > IQ_LIM) ? IQ_LIM : ((b < -IQ_LIM) ? -IQ_LIM : b);
+}
+
+void __not_in_flash_func(iq_balance)(void)
+{
+	int b;
+	
+	if (dsp_iq == IQ_OFF)
+	{
+		iq_a = 0; iq_b = 0;
+		return;
+	}
+	b = dsp_active + 2;														// Newest saved buffer
+	if (b > 2) b -= 3;
+	iq_block(I_buf[b], Q_buf[b], dsp_iqblk, (dsp_iq == IQ_ADAPT));
+}
+
+
+
+/** CORE1: ADC acquisition **/
+/*
+ * The ADC runs free in round-robin mode (ADC0..2), paced by its own clock, and two chained DMA 
+ * channels fill a ping-pong pair of blocks from the ADC FIFO. Each block holds ADC_BLK samples 
+ * of ADC_INT conversions per channel, and raises one IRQ when full, while the other channel continues.
+ * clk_adc is 48MHz and a conversion takes 1+ADC_DIV cycles, so the conversion rate is 
+ * 48MHz/128 = 375kSps, which is exactly 3 * ADC_INT * S_RATE. The sample clock is therefore 
+ * derived from the crystal only, and does not depend on interrupt latency.
+ * The full 500kSps would give 10.67 conversions per channel per sample, not an integer ratio.
+ * The block handler decimates a whole block in one go with a CIC/halfband chain (see decim.c), 
+ * into ADC_BLK<<rate samples per channel at the I/Q rate,
+ * and copies the result into the active I, Q or A queue buffer. It also maintains the queue 
+ * indexes, and triggers the DSP loop when a buffer is full.
  * These are all registers used for the sample acquisition process
  */
 #define LSH 		8														// Left shift for higher accuracy of level, also LPF
 #define ADC_LEVELS	(ADC_BIAS/2)<<LSH										// Left shifted initial ADC level value
-#define BSH			8														// Left shift for higher accuracy of bias, also LPF
-#define ADC_BIASS	ADC_BIAS<<BSH											// Left shifted initial ADC bias value
-#define ADC_INT		8														// Nr of samples for integration (max 8, depends on e.g. sample rate)
-volatile int16_t  adc_sample[ADC_INT][3];									// ADC sample collection, filled by DMA
-volatile int32_t  adc_bias[3] = {ADC_BIASS, ADC_BIASS, ADC_BIASS};			// ADC dynamic bias (DC) level
-volatile int32_t  adc_result[3];											// ADC bias-filtered result for further processing
+#define ADC_INT		DEC_RATIO												// Nr of conversions per channel per sample, 8
+#define ADC_DIV		(48000000/(3*ADC_INT*S_RATE) - 1)						// ADC clock divider, 127 for 375kSps
+#define CH0			0														// DMA channels for the ping-pong blocks
+#define CH1			1
+#if (BUFSIZE % ADC_BLK) != 0
+#error "BUFSIZE must be a multiple of ADC_BLK"
+#endif
+volatile uint16_t adc_blk[2][ADC_BLK*ADC_INT*3] __attribute__((aligned(4)));	// ADC conversion blocks, filled by DMA
+int16_t           adc_dec[3][ADC_BLK<<RATE_62];								// Decimated block per channel
 volatile uint32_t adc_level[3] = {ADC_LEVELS, ADC_LEVELS, ADC_LEVELS};		// Signa levels for ADC channels
-volatile int adccnt = 0;													// Sampling overflow indicator
+volatile int adccnt = 0;													// Nr of ADC blocks handled
 
+semaphore_t dsp_sem;														// Released once per full buffer
 
 
 /** CORE1: DMA IRQ handler **/
@@ -263,148 +973,156 @@ volatile int adccnt = 0;													// Sampling overflow indicator
 // 0x00000002 [1]     : HIGH_PRIORITY (0): HIGH_PRIORITY gives a channel preferential treatment in issue scheduling: in...
 // 0x00000001 [0]     : EN (0): DMA Channel Enable
 
-// 0x00120027 (IRQ_QUIET=0x0, TREQ_SEL=0x24, CHAIN_TO=0, INCR_WRITE=1, INCR_READ=0, DATA_SIZE=1, HIGH_PRIORITY=1, EN=1)	
-
 /*
- * The DMA handler only stops conversions and resets interrupt flag, data is processed in timer callback.
+ * A block is complete, re-arm its channel for the next round and decimate the block.
+ * The decimator also removes the DC bias, its output is 8x the ADC LSB.
+ * The audio level for VOX is updated per sample, left shifted by LSH = 8 (the S-meter is done by the RX branch)
+ * LPF RC: ((1<<LSH)-1)*64usec = 16msec, at S_RATE
+ * Depending on the branch, the I and Q or the A samples are stored in the active queue buffer.
+ * When the buffer is full, the queues and the DAC output blocks move on, and the DSP loop is triggered.
  */
-#define CH0			0
-#define DMA_CTRL0	0x00120027
 void __not_in_flash_func(dma_handler)(void)
 {
-	adc_run(false);															// Stop freerunning ADC
-	dma_hw->ints0 = 1u << CH0;												// Clear the interrupt request.
-	//while (!adc_fifo_is_empty()) adc_fifo_get();							// Empty leftovers from fifo
-	adccnt++;																// ADC overrun indicator increment
-}
-
-
-/** CORE1: Timer callback routine **/
-
-/*
- * This runs every TIM_US, i.e. 64usec, and hence determines the actual sample rate
- * The filtered samples are set aside, so a new ADC cycle can be started. 
- * One ADC cycle takes 6usec to complete (3x ADC0..2) + 1x 2usec stray ADC0 conversion.
- * The timing is critical, it assumes that the ADC is finished.
- * Do not put any other stuff in this callback routine.
- */
-semaphore_t dsp_sem;
-repeating_timer_t dsp_timer;
-volatile int cnt = 4;
-volatile int32_t rx_agc = 1, tx_agc = 1;									// Factor as AGC
-bool __not_in_flash_func(dsp_callback)(repeating_timer_t *t) 
-{
-	int32_t temp;
+	int ch, i, n, t;
+	int32_t s0, s1, s2;
+	volatile uint16_t *bp;
+	int16_t *dp[3] = {adc_dec[0], adc_dec[1], adc_dec[2]};
+	bool tx;
 	
-	/** Here the rate is: S_RATE=1/TIM_US, assume 15625Hz **/
-
-	// Get ADC_INT samples for each channel and correct for DC bias
-	// LPF RC: ((1<<BSH)-1)*64usec = 16msec
-	// adc_result is reset every 64usec, adc_bias is not and hence a running average.
-	adc_result[0] = 0;
-	adc_result[1] = 0;
-	adc_result[2] = 0;
-	for (temp = 0; temp<ADC_INT; temp++)
+	PROF_START(PROF_COPY);
+	ch = (dma_hw->ints0 & (1u << CH0)) ? CH0 : CH1;							// Only one block completes at a time
+	dma_hw->ints0 = 1u << ch;												// Clear the interrupt request
+	bp = &adc_blk[ch][0];
+	dma_channel_set_write_addr(ch, bp, false);								// Re-arm, started by chain from other channel
+	adccnt++;
+
+	tx = tx_enabled;
+
+	// Decimate the block, and copy into the active queue buffers
+	n = ADC_BLK<<dsp_rate;
+	dec_block(bp, n, dp);
+	t = dsp_tick;
+	for (i=0; i<n; i++, t++)
 	{
-		adc_bias[0]   += (int32_t)(adc_sample[temp][0]) - (adc_bias[0]>>BSH);
-		adc_result[0] += (int32_t)(adc_sample[temp][0]) - (adc_bias[0]>>BSH);
-		adc_bias[1]   += (int32_t)(adc_sample[temp][1]) - (adc_bias[1]>>BSH);
-		adc_result[1] += (int32_t)(adc_sample[temp][1]) - (adc_bias[1]>>BSH);
-		adc_bias[2]   += (int32_t)(adc_sample[temp][2]) - (adc_bias[2]>>BSH);
-		adc_result[2] += (int32_t)(adc_sample[temp][2]) - (adc_bias[2]>>BSH);
-	}
-		
-	// Load new acquisition phase
-	// So restart ADCs and DMA
-	adccnt--;																// ADC overrun indicator decrement
-	adc_select_input(0);													// Start with ADC0
-	while (!adc_fifo_is_empty()) adc_fifo_get();							// Empty leftovers from fifo, if any
-
-	dma_hw->ch[CH0].read_addr = (io_rw_32)&adc_hw->fifo;					// Read from ADC FIFO
-	dma_hw->ch[CH0].write_addr = (io_rw_32)&adc_sample[0][0];				// Write to sample buffer
-	dma_hw->ch[CH0].transfer_count = ADC_INT * 3;							// Nr of 16 bit words to transfer
-	dma_hw->ch[CH0].ctrl_trig = DMA_CTRL0;									// Write ctrl word while starting the DMA
-
-	adc_run(true);															// Start ADC too
-
-	// Calculate and save signal level, value is left shifted by LSH = 8
-	// LPF RC: ((1<<LSH)-1)*64usec = 16msec
-	adc_level[0] += (ABS(adc_result[0]))-(adc_level[0]>>LSH);
-	adc_level[1] += (ABS(adc_result[1]))-(adc_level[1]>>LSH);
-	adc_level[2] += (ABS(adc_result[2]))-(adc_level[2]>>LSH);
-
-	// Derive RSSI value from RX vector length
-	// Crude AGC mechanism **NEEDS TO BE IMPROVED**
-	if (!tx_enabled)	
-	{
-		// Approximate amplitude, with alpha max + beta min function
-		uint32_t i=adc_level[1],q=adc_level[0];
-		if (i>q)
-			temp = (MAX(i,((29*i/32) + (61*q/128))))>>LSH;
+		s0 = adc_dec[0][i]; s1 = adc_dec[1][i]; s2 = adc_dec[2][i];
+		if (tx)
+			A_buf[dsp_active][A_IDX(t)] = (int16_t)s2;						// Copy A sample to A buffer
 		else
-			temp = (MAX(q,((29*q/32) + (61*i/128))))>>LSH;
-		s_rssi = MAX(1,temp);
-		rx_agc = AGC_TOP/s_rssi;											// calculate scaling factor
-		if (rx_agc==0) rx_agc=1;
-	}
-		
-#if DSP_FFT == 1
-
-	// Copy samples from/to the right buffers
-	if (tx_enabled)
-	{								
-		A_buf[dsp_active][dsp_tick] = (int16_t)(tx_agc*adc_result[2]);		// Copy A sample to A buffer
-		pwm_set_gpio_level(DAC_I, I_buf[dsp_active][dsp_tick] + DAC_BIAS);	// Output I to DAC
-		pwm_set_gpio_level(DAC_Q, Q_buf[dsp_active][dsp_tick] + DAC_BIAS);	// Output Q to DAC
-	}
-	else
-	{
-		I_buf[dsp_active][dsp_tick] = (int16_t)(rx_agc*adc_result[1]);		// Copy I sample to I buffer
-		Q_buf[dsp_active][dsp_tick] = (int16_t)(rx_agc*adc_result[0]);		// Copy Q sample to Q buffer
-		pwm_set_gpio_level(DAC_A, A_buf[dsp_active][dsp_tick] + DAC_BIAS);	// Output A to DAC
+		{
+			I_buf[dsp_active][t] = (int16_t)s1;								// Copy I sample to I buffer
+			Q_buf[dsp_active][t] = (int16_t)s0;								// Copy Q sample to Q buffer
+		}
+		adc_level[2] += ABS(s2) - (adc_level[2]>>LSH);					// Audio level for VOX
 	}
 	
 	// When I, Q or A buffer is full, move pointer to the next and signal the DSP loop
-	if (++dsp_tick >= BUFSIZE)												// Increment tick and check range
+	if (t >= dsp_iqblk)
 	{
-		dsp_tick = 0;														// Reset counter
+		t = 0;																// Reset counter
 		if (++dsp_active > 2) dsp_active = 0;								// Point to next buffer
+		if (dac_run)
+			dac_play ^= 1;													// DMA has moved to the other output block
+		else
+		{
+			dma_start_channel_mask((1u << CH2) | (1u << CH4));				// Start output, in phase with the queues
+			dac_run = true;
+		}
 		dsp_overrun++;														// Increment overrun counter
 		sem_release(&dsp_sem);												// Signal background processing
 	}
-	
-#else
+	dsp_tick = t;
+	PROF_STOP(PROF_COPY);
+}
+
 
-	// Copy samples from/to the right buffers
-	if (tx_enabled)
+
+/** CORE1: Apply a new I/Q sample rate **/
+/*
+ * Called from dsp_snapshot(), between two blocks.
+ * The block handler is held off, and the DAC channels are stopped: these are unchained first,
+ * since an abort could otherwise trigger the partner channel.
+ * The queues restart empty, and the block handler starts the output again on the first wrap.
+ * The ADC and its DMA keep running, a block that completes meanwhile is handled afterwards.
+ */
+static void dsp_rate_apply(int rate)
+{
+	int i;
+	
+	irq_set_enabled(DMA_IRQ_0, false);										// Hold off the block handler
+	for (i=CH2; i<=CH5; i++)												// Stop output
 	{
-		a_sample = tx_agc * adc_result[2];									// Store A sample for background processing
-		pwm_set_gpio_level(DAC_I, i_sample);								// Output calculated I sample to DAC
-		pwm_set_gpio_level(DAC_Q, q_sample);								// Output calculated Q sample to DAC
-	}
-	else
-	{							
-		q_sample = rx_agc * adc_result[0];									// Store Q sample for background processing
-		i_sample = rx_agc * adc_result[1];									// Store I sample for background processing
-		pwm_set_gpio_level(DAC_A, a_sample);								// Output calculated A sample to DAC
+		dma_channel_config c = dma_get_channel_config(i);
+		channel_config_set_chain_to(&c, i);									// Chain to itself is no chain
+		dma_channel_set_config(i, &c, false);
 	}
-	dsp_overrun++;															// Increment overrun counter
-	sem_release(&dsp_sem);													// Signal background processing
+	dma_channel_abort(CH2); dma_channel_abort(CH3);
+	dma_channel_abort(CH4); dma_channel_abort(CH5);
+	dac_run = false;
+	dac_play = 0;
+	
+	dsp_rate  = rate;														// Derived settings
+	dsp_iqblk = IQ_BLK(dsp_rate);
+	dsp_ablk  = A_BLK(dsp_rate);
+	dec_init(ADC_BIAS, dsp_rate);
+	
+	dac_mute(true);															// Restart silent
+	dac_mute(false);
+	dac_config();
+	dsp_tick = 0;
+	irq_set_enabled(DMA_IRQ_0, true);
+}
 
-#endif
-		
 
-	return true;
-}
+
+/** CORE1: Settings snapshot **/
+/*
+ * Take a consistent copy of the settings mailbox, when it has changed, see dsp_put().
+ * The derived settings are only computed for what changed.
+ * Returns true when the queued block must be dropped, i.e. after a rate change.
+ */
+dsp_set_t dsp_cur;															// Settings in use
+uint32_t  dsp_seqx = 1;														// Sequence of dsp_cur, odd forces the first snapshot
+static bool dsp_snapshot(void)
+{
+	uint32_t seq;
+	dsp_set_t s;
+	bool drop;
+	int i;
 	
+	seq = dsp_seq;
+	if ((seq == dsp_seqx) || (seq & 1)) return false;						// No change, or update in progress
+	__dmb();
+	s.mode = dsp_req.mode; s.flank = dsp_req.flank; s.agc = dsp_req.agc; s.vox = dsp_req.vox; s.rate = dsp_req.rate;
+	s.iq = dsp_req.iq; s.nr = dsp_req.nr; s.notch = dsp_req.notch; s.nco[0] = dsp_req.nco[0]; s.nco[1] = dsp_req.nco[1];
+	for (i=0; i<CHAN_MAX; i++) { s.chan_mode[i] = dsp_req.chan_mode[i]; s.chan_off[i] = dsp_req.chan_off[i]; }
+	__dmb();
+	if (seq != dsp_seq) return false;										// Torn, retry next block
+	
+	drop = (s.rate != dsp_rate);
+	if (drop) dsp_rate_apply(s.rate);										// Also changes the block time
+	dsp_mode  = s.mode;
+	dsp_flank = s.flank;
+	dsp_iq    = s.iq;
+	dsp_nr    = s.nr;
+	dsp_notch = s.notch;
+	for (i=0; i<CHAN_MAX; i++) { dsp_chan[i] = s.chan_mode[i]; dsp_choff[i] = s.chan_off[i]; }
+	if (drop || (s.agc != dsp_cur.agc) || (dsp_seqx & 1)) agc_derive(s.agc);
+	if ((s.vox != dsp_cur.vox) || (dsp_seqx & 1)) vox_derive(s.vox);
+	if (drop || (s.nco[0] != dsp_cur.nco[0]) || (s.nco[1] != dsp_cur.nco[1])) nco_derive(s.nco[0], s.nco[1]);
+	dsp_cur  = s;
+	dsp_seqx = seq;
+	return drop;
+}
+
 
 
-/** CORE1: DSP loop, triggered through repeating timer/semaphore **/
+/** CORE1: DSP loop, triggered through block handler/semaphore **/
 void __not_in_flash_func(dsp_loop)()
 {
 	uint32_t cmd;
 	uint16_t slice_num;
-	alarm_pool_t *ap;
+	uint32_t t0;
+	int i;
 	
 	tx_enabled = false;	
 	vox_active = false;
@@ -429,7 +1147,7 @@ void __not_in_flash_func(dsp_loop)()
 
 	/* 
 	 * Initialize ADCs, use in round robin mode (3 channels)
-	 * samples are stored in array through IRQ callback
+	 * conversions are paced by the ADC clock and moved by DMA
 	 */
 	adc_init();																// Initialize ADC to known state
 	adc_gpio_init(ADC_Q);													// ADC GPIO for Q channel
@@ -437,50 +1155,55 @@ void __not_in_flash_func(dsp_loop)()
 	adc_gpio_init(ADC_A);													// ADC GPIO for Audio channel
 	adc_set_round_robin(0x01+0x02+0x04);									// Sequence ADC 0-1-2 (GP 26, 27, 28) free running
 	adc_select_input(0);													// Start with ADC0
-	adc_fifo_setup(true,true,3,false,false);								// IRQ result, DMA req, fifo thr=3: xfer per 3 x 16 bits
-	adc_set_clkdiv(0);														// Fastest clock (500 kSps)
+	adc_fifo_setup(true,true,1,false,false);								// FIFO, DMA req, thr=1: xfer per 16 bits
+	adc_set_clkdiv(ADC_DIV);												// 375 kSps, 8 conversions per channel per sample
+	dec_init(ADC_BIAS, dsp_rate);											// Decimator starts at nominal DC level
 
 	/*
-	 * Setup and start DMA channel CH0
+	 * Setup DMA channels CH0 and CH1, chained to each other
+	 * Each transfers one block from the ADC FIFO, paced by the ADC DREQ
 	 */
-	dma_channel_set_irq0_enabled(CH0, true);								// Raise IRQ line 0 when the channel finishes a block
+	for (i=CH0; i<=CH1; i++)
+	{
+		dma_channel_config c = dma_channel_get_default_config(i);
+		channel_config_set_transfer_data_size(&c, DMA_SIZE_16);				// 16 bit samples
+		channel_config_set_read_increment(&c, false);						// Always read the FIFO
+		channel_config_set_write_increment(&c, true);						// Fill the block
+		channel_config_set_dreq(&c, DREQ_ADC);								// Paced by ADC
+		channel_config_set_chain_to(&c, (i==CH0)?CH1:CH0);					// Continue with other block when done
+		channel_config_set_high_priority(&c, true);
+		dma_channel_configure(i, &c, &adc_blk[i][0], &adc_hw->fifo, ADC_BLK*ADC_INT*3, false);
+		dma_channel_set_irq0_enabled(i, true);								// Raise IRQ line 0 when the channel finishes a block
+	}
 	irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);						// Install IRQ handler
+	irq_set_priority(DMA_IRQ_0, PICO_LOWEST_IRQ_PRIORITY);					// Below timer, the block handler may be interrupted
 	irq_set_enabled(DMA_IRQ_0, true);										// Enable it
-	irq_set_priority(DMA_IRQ_0, PICO_HIGHEST_IRQ_PRIORITY);					// Prevent race condition with timer
-	
-	dma_hw->ch[CH0].read_addr = (io_rw_32)&adc_hw->fifo;					// Read from ADC FIFO
-	dma_hw->ch[CH0].write_addr = (io_rw_32)&adc_sample[0][0];				// Write to sample buffer
-	dma_hw->ch[CH0].transfer_count = ADC_INT * 3;							// Nr of 16 bit words to transfer
-	dma_hw->ch[CH0].ctrl_trig = DMA_CTRL0;									// Write ctrl word and start the DMA
-
-	adc_run(true);															// Also start the ADC
 
-	
 	/*
-	 * Use alarm_pool_add_repeating_timer_us() for a core1 associated timer
-	 * First create an alarm pool on core1:
-	 * alarm_pool_t *alarm_pool_create( uint hardware_alarm_num, 
-	 *                                  uint max_timers);
-	 * For the core1 alarm pool don't use the default alarm_num (usually 3) but e.g. 1
-	 * Timer callback signals semaphore, while loop blocks on getting it.
-	 * Initialize repeating timer on core1:
-	 * bool alarm_pool_add_repeating_timer_us( alarm_pool_t *pool, 
-	 *                                          int64_t delay_us, 
-	 *                                         repeating_timer_callback_t callback, 
-	 *                                         void *user_data, 
-	 *                                         repeating_timer_t *out);
+	 * Setup DMA channels CH2..CH5 for the DACs, see dac_config()
 	 */
-	sem_init(&dsp_sem, 0, 1);
-	ap = alarm_pool_create(1, 4);
-	alarm_pool_add_repeating_timer_us( ap, -TIM_US, dsp_callback, NULL, &dsp_timer);
+	dac_mute(true);															// Start silent
+	dac_mute(false);
+	dac_config();
 
+	sem_init(&dsp_sem, 0, 1);
 	dsp_overrun = 0;
+	PROF_INIT();															// Stage profiler, if enabled
+
+	adc_fifo_drain();														// Start clean, with ADC0
+	dma_channel_start(CH0);													// Arm first block
+	adc_run(true);															// Start the ADC, runs continuously from now on
 	
 	// Background processing loop
     while(1) 
 	{
-		sem_acquire_blocking(&dsp_sem);										// Wait until timer-callback releases sem
+		sem_acquire_blocking(&dsp_sem);										// Wait until block handler releases sem
 		dsp_overrun--;														// Decrement overrun counter
+		t0 = time_us_32();													// Start of block processing
+		PROF_START(PROF_LOOP);
+
+		if (dsp_snapshot())													// New settings, between blocks
+			continue;														// The queued block is dropped
 
 		// Use adc_level[2] for VOX
 		if (vox_level == 0)													// Only when VOX is enabled
@@ -492,8 +1215,13 @@ void __not_in_flash_func(dsp_loop)()
 				vox_count = S_RATE * VOX_LINGER / 1000;						// While audio present, reset linger timer
 				vox_active = true;											//  and keep TX active
 			}
-			else if (--vox_count>0)											// else decrement linger counter
+			else if (vox_count > 0)											// else count down linger, per block
+			{
+				vox_count -= dsp_ablk;
 				vox_active = true;											//  and keep TX active until 0
+			}
+			else
+				vox_active = false;
 		}
 
 
@@ -505,15 +1233,24 @@ void __not_in_flash_func(dsp_loop)()
 		else
 		{
 			gpio_put(GP_PTT, true);											// Drive PTT high (inactive)   
+			iq_balance();													// Correct I/Q imbalance of the newest block
 			rx();															// Do RX signal processing
 		}
 		
 		/** !!! This is a trap, ptt remains active after once asserted: TO BE CHECKED! **/
+		if (tx_enabled != (vox_active || ptt_active))						// Branch changes: silence DACs that become idle
+		{
+			dac_mute(tx_enabled);
+#if DSP_FFT == 1
+			FFT_WORK_SWITCH(!tx_enabled);									// Queues of the new branch may hold FFT passes
+#endif
+		}
 		tx_enabled = vox_active || ptt_active;								// Check RX or TX	
 		
-#if DSP_FFT == 1
 		dsp_tickx = dsp_tick;
-#endif
+		dsp_shedding(time_us_32() - t0);									// Quality level for next block
+		PROF_STOP(PROF_LOOP);
+		PROF_BLOCK();
 	}
 }
 
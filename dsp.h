@@ -15,8 +15,13 @@
 
 
 /* 
- * Callback timeout is TIM_US, value in usec
+ * Audio sample period is TIM_US, value in usec
  * The carrier offset is !=0 only in FFT case.
+ * Samples are acquired and output in blocks, the DSP loop runs once per block.
+ * The I/Q sample rate can be S_RATE, or 2x or 4x S_RATE, see dsp_setrate().
+ * FFT: a block is BUFSIZE I/Q samples, and BUFSIZE>>rate audio samples.
+ * Time domain: a block is BUFSIZE<<rate I/Q samples, and BUFSIZE audio samples.
+ * IQSIZE is the largest I/Q block.
  */
  
 #if DSP_FFT == 1
@@ -24,20 +29,30 @@
 #define TIM_US		   64
 #define S_RATE		15625					// 1e6/TIM_US
 #define FC_OFFSET	 3906  					// RX carrier in bin FFT_SIZE/4 ==> S_RATE/4
+#define BUFSIZE		(FFT_SIZE/2)			// I/Q samples per block, half the FFT frame
+#define IQSIZE		BUFSIZE
+#define NCO_WIN(r)	((r)==RATE_15 ? 250 : 2000)	// Max NCO offset in Hz, at S_RATE the passband is close to Nyquist
 
 #else
 	
 #define TIM_US		   64
 #define S_RATE		15625					// 1e6/TIM_US
 #define FC_OFFSET 	    0					// Must be 0 for time-domain DSP
+#define BUFSIZE		   64					// Audio samples per block, 4.1msec
+#define IQSIZE		(BUFSIZE<<RATE_62)
+#define NCO_WIN(r)	2000					// Max NCO offset in Hz
 
 #endif
 
 
 /** DSP module interface **/
 
-extern volatile uint32_t s_rssi;
-int get_sval(void);
+#define SMTR_PEAK		0
+#define SMTR_AVG		1
+#define SMTR_FLOOR		2
+int  dsp_getlevel(int which);				// S-meter level in 0.1dBm
+void dsp_setcal(int band, int attn);		// S-meter calibration, for the relay settings
+int  get_sval(void);
 
 extern volatile bool tx_enabled;			// Determined by (vox_active || ptt_active)
 
@@ -53,11 +68,57 @@ void dsp_setvox(int vox);
 #define MODE_CW			3
 void dsp_setmode(int mode);
 
+#define FLANK_MIN		1
+#define FLANK_MAX		15
+#define FLANK_DEFAULT	5					// Nr of bins with 0 < gain < 1, 5 gives a 7 bin raised cosine
+void dsp_setflank(int flank);
+
+#define RATE_15			0					// I/Q sample rate S_RATE, 15625Hz
+#define RATE_31			1					// 2x S_RATE, 31250Hz
+#define RATE_62			2					// 4x S_RATE, 62500Hz
+void dsp_setrate(int rate);
+int  dsp_getrate(void);
+
 #define AGC_NONE		0
 #define AGC_SLOW		1
 #define AGC_FAST		2
 void dsp_setagc(int agc);
 
+#define IQ_OFF			0					// No correction, coefficients reset
+#define IQ_ADAPT		1					// Continuous estimation and correction
+#define IQ_FREEZE		2					// Correction with the last estimate
+void dsp_setiq(int iq);
+
+#define NR_OFF			0					// Noise reduction strength, FFT engine only
+#define NR_LOW			1
+#define NR_MEDIUM		2
+#define NR_HIGH			3
+void dsp_setnr(int nr);
+#define NOTCH_MAX		4					// Max nr of auto-notch carriers
+void dsp_setnotch(int on);					// Auto-notch, FFT engine only
+
+void dsp_setnco(int rx, int tx);			// Fine tuning offsets in Hz, within +/-NCO_WIN(rate)
+
+#define CHAN_MAX		4					// Nr of extra receiver channels, FFT engine only
+#define CHAN_OFF		(-1)				// Channel mode when not in use, others are MODE_xxx
+void dsp_setchan(int c, int mode, int offset);	// Channel c: mode, and offset in Hz from the tuned frequency
+int  dsp_getchan(int c);					// Channel c: passband level in 0.1dBm
+
+/*
+ * Spectrum frames, published by the FFT engine once per RX block, see dsp.c
+ * A value is the peak bin power of a group of FFT_SIZE/SPEC_NBIN bins, in dBFS + SPEC_DB0.
+ * The frame runs from -(S_RATE<<rate)/2 to +(S_RATE<<rate)/2 around the LO frequency plus the RX NCO offset.
+ */
+#define SPEC_NBIN		128					// Bins per frame, a divisor of FFT_SIZE
+#define SPEC_DB0		150					// Value 0 is -150dBFS
+typedef struct
+{
+	uint32_t seq;							// Frame nr, counts the RX blocks
+	int      rate;							// I/Q rate of the frame
+	uint8_t  db[SPEC_NBIN];
+} spec_frame_t;
+bool dsp_getspec(spec_frame_t *f);			// CORE0: take the newest frame, false when none or stale
+
 void dsp_init();
 
 #endif
@@ -10,15 +10,13 @@
  * In this case it runs when half FFT_SIZE of samples is ready to be processed.
  *
  *
- * The pace for sampling is set by a timer at 64usec (15.625 kHz)
- * The associated timer callback routine:
- * - handles data transfer to/from physical interfaces
- * - starts a new ADC conversion sequence 
+ * The pace for sampling is set by the ADC clock, at 64usec (15.625 kHz) per sample
+ * The ADC runs continuously in round-robin and fifo mode (ADC[0..2]), DMA fills blocks of samples
+ * The associated DMA IRQ handler, see dsp.c:
+ * - decimates a complete block of ADC samples into the active I, Q or A buffer
  * - maintains dsp_tick counter
  * - when dsp_tick == FFT_SIZE/2 (one buffer), the dsp-loop is triggered.
- *
- * The ADC functions in round-robin and fifo mode, triggering IRQ after 3 conversions (ADC[0..2])
- * The ADC FIFO IRQ handler reads the 3 samples from the fifo after stopping the ADC
+ * The DACs are fed by DMA from output blocks, paced by a DMA timer, also see dsp.c
  *
  * Buffer structure, built from half FFT_SIZE buffers.
  * The I, Q and A external interfaces communicate each through 3x buffers.
@@ -40,12 +38,11 @@
  *  q --> |  |  |  |
  *        +--+--+--+
  *
- * RX, when triggered by timer callback:
- * - The oldest two I and Q buffers are copied into the FFT buffers
- * - FFT is executed
+ * RX, when triggered by the block handler:
+ * - FFT is executed, reading the oldest two I and Q buffers as input frame
  * - Signal processing is done
  * - iFFT is executed
- * - The oldest real FFT buffer is moved to the A output queue
+ * - The newest half of the real FFT buffer is written to the audio DAC output block
  *
  *        +--+--+--+                                   +--+--+--+
  *  a --> |  |  |  |                                   |  |  |  | --> i
@@ -59,166 +56,786 @@
  *                                                     |  |  |  | --> q
  *                                                     +--+--+--+
  *
- * TX, when triggered by timer callback:
- * - The oldest two A buffers are copied to the real FFT buffer, the imaginary FFT buffer is nulled
- * - FFT is executed
+ * TX, when triggered by the block handler:
+ * - Real input FFT is executed, i.e. a half size complex FFT and a post-processing pass
+ *   The oldest two A buffers are its input frame, the handler stores even samples in the first half
+ *   and odd samples in the second half of an A buffer, these are the Re and Im input
  * - Signal processing is done
  * - iFFT is executed
- * - The oldest FFT buffers are appended to the I/Q output queues
+ * - The newest half of the FFT buffers is written to the I/Q DAC output block
  *
  * The bin step is the sampling frequency divided by the FFT_SIZE.
  * So for S_RATE=15625 and FFT_SIZE=1024 this step is 15625/1024=15.259 Hz
  * The Carrier offset (Fc) is at about half the Nyquist frequency: bin 256 or 3906 Hz
  *
+ * At the higher I/Q rates the frame is the same size, so the bins are 2x or 4x wider and a block 
+ * is 2x or 4x shorter. The carrier offset stays 3906 Hz, bin 128 or 64.
+ * RX decimates in the iFFT: the bandpass leaves nothing above 3kHz, so the shifted bins fit in a
+ * transform of FFT_SIZE/2 or FFT_SIZE/4 bins at the same bin step. Its output is at S_RATE, and 
+ * equals every 2nd or 4th sample of the full iFFT. So the audio DAC stays at S_RATE.
+ * At RATE_15 the same holds for a FFT_SIZE/2 transform at S_RATE/2, the halfband interpolator
+ * rx_interp() brings its output back to S_RATE.
+ *
  */
 
+#include <string.h>
 #include "uSDR.h"
 
 /*
  * FFT buffer allocation
- * Buffer size is FFT_SIZE/2 (see fix_fft.h).
+ * Buffer size is FFT_SIZE/2 (see fix_fft.h), and BUFSIZE*TIM_US is the block time.
  * In case FFT_SIZE of 1024, a buffer is 1kB
- *  RX:  3 buffers for I samples, 3 buffers for Q samples, 3 buffers for Audio
- *  DSP: 4 buffers for FFT, complex samples and these have to be consecutive!
- *  TX:  re-use RX buffers in reverse order
- * Total of 13kByte RAM is required.
+ *  RX:  3 buffers for I samples, 3 buffers for Q samples
+ *  TX:  3 buffers for A samples, each with the even samples in the first and odd samples in the second half
+ *  DSP: 4 buffers for FFT, complex samples
+ * Total of 13kByte RAM is required, plus 6kByte for the DAC output blocks in dsp.c
  * Samples are 16 bit signed integer, but align buffers on 32bit boundaries
  * dsp_tick points into I, Q and A buffers, so wrap once per two FFTs
- * When tick==FFT_SIZE/2: do buffer copy
+ *
+ * The input queues are read directly by the FFT, as a frame of the two non-active buffers.
+ * The 50% overlap of consecutive frames is just the index of the newest buffer. 
+ * Output is written once per block, from the newest half of the FFT buffers into the DAC output 
+ * block that is not being played.
  */ 
-#define BUFSIZE		FFT_SIZE/2
 int16_t  I_buf[3][BUFSIZE] __attribute__((aligned(4)));						// I sample queue, 3x buffer of FFT_SIZE/2
 int16_t  Q_buf[3][BUFSIZE] __attribute__((aligned(4)));						// Q sample queue, 3x buffer of FFT_SIZE/2
 int16_t  A_buf[3][BUFSIZE] __attribute__((aligned(4)));						// A sample queue, 3x buffer of FFT_SIZE/2
 int16_t XI_buf[FFT_SIZE] __attribute__((aligned(4)));						// Re FFT buffer, 1x buffer of FFT_SIZE
 int16_t XQ_buf[FFT_SIZE] __attribute__((aligned(4)));						// Im FFT buffer, 1x buffer of FFT_SIZE
 
-// Sample buffer indexes, updated by timer callback
-volatile int      dsp_active = 0;											// I, Q, A active buffer number (0..2)
-volatile uint32_t dsp_tick   = 0;											// Index in active buffer
-volatile uint32_t dsp_tickx  = 0;											// Load indicator DSP loop
+// Sample access for the block handler
+#define A_IDX(t)		(((t)&1)*(BUFSIZE/2) + ((t)>>1))					// Even/odd split A buffer index
+#define X_OUT(x)		DAC_CLIP((x) + DAC_BIAS)							// Output sample, scaled into DAC_RANGE
+#define TX_GAIN			(-(3<<16))											// Log2 Q16 of TX gain, 1/8 like time domain
+#define TX_CW			(DAC_BIAS-8)										// CW carrier amplitude, DAC steps
+#define TX_AM			(DAC_BIAS/2)										// AM carrier amplitude, half the range
+#define TX_RISE			5000												// usec
+int tx_env = 0;																// Samples since key down
+
+#if FFT_STOCKHAM == 1
+/*
+ * The Stockham FFT ping-pongs between XI/XQ and a second buffer pair, the buffers not used in a branch:
+ * in RX the A queue and the old Q buffer, which is free once the input frame has been read.
+ * In TX the I and Q queues.
+ * So on a branch change the queues of the new branch hold FFT passes instead of samples. They are
+ * cleared before the block handler starts filling them, so the first frames start from silence.
+ */
+#define FFT_WORK_RX(b)		fix_fft_work(A_buf[0], A_buf[1], A_buf[2], Q_buf[b])
+#define FFT_WORK_TX()		fix_fft_work(I_buf[0], I_buf[1], Q_buf[0], Q_buf[1])
+#define FFT_WORK_SWITCH(tx)	{ if (tx) memset(A_buf, 0, sizeof(A_buf)); \
+							  else { memset(I_buf, 0, sizeof(I_buf)); memset(Q_buf, 0, sizeof(Q_buf)); } }
+#else
+#define FFT_WORK_RX(b)
+#define FFT_WORK_TX()
+#define FFT_WORK_SWITCH(tx)
+#endif
+
+// Spectrum bins for a frequency, derived from the I/Q rate and FFT_SIZE, see fft_bins()
+// For S_RATE=15625 and FFT_SIZE=1024: 256, 7, 20, 59 and 197
+#define BIN(f)			(int)(((f)*FFT_SIZE+(S_RATE<<dsp_rate)/2)/(S_RATE<<dsp_rate))
+#define BIN_FC			fft_bin[0]											// BIN_FC > BIN_3000 to avoid aliasing!
+#define BIN_100       	fft_bin[1]
+#define BIN_300		 	fft_bin[2]
+#define BIN_900		 	fft_bin[3]
+#define BIN_3000		fft_bin[4]
+int fft_bin[5];
+int fft_rate = -1;															// Rate of the bins
+
+/* 
+ * Update the bins when the rate has changed, called at the start of rx() and tx()
+ */
+static inline void fft_bins(void)
+{
+	if (fft_rate == dsp_rate) return;
+	fft_rate = dsp_rate;
+	BIN_FC   = BIN(FC_OFFSET);
+	BIN_100  = BIN(100);
+	BIN_300  = BIN(300);
+	BIN_900  = BIN(900);
+	BIN_3000 = BIN(3000);
+}
+
+
+
+
+/*
+ * Spectral mask for dsp_bandpass(), Q15 gain per bin [0, 32767]
+ * Only the positive frequency bins are stored, the negative side is mirrored.
+ * Gains are valid for bins mask_lo..mask_hi, all other bins are nulled.
+ * The passband stays below BIN_FC, so the sideband shifts never fold it, see dsp_passhi().
+ * The table is rebuilt only when edges, flank length or rate change, i.e. on mode or bandwidth change.
+ */
+int16_t mask_gain[FFT_SIZE/2] __attribute__((aligned(4)));
+int mask_lo, mask_hi;														// Non-zero range, inclusive
+int mask_key[4] = {-1, -1, -1, -1};											// lowbin, highbin, flank and BIN_FC of the table
 
-// Spectrum bins for a frequency
-#define BIN(f)			(int)(((f)*FFT_SIZE+S_RATE/2)/S_RATE)
-#define BIN_FC			  256												// BIN_FC > BIN_3000 to avoid aliasing!
-#define BIN_100       	    7
-#define BIN_300		 	   20
-#define BIN_900		 	   59
-#define BIN_3000		  197
+/*
+ * First and last bin that dsp_bandpass() passes for lowbin and highbin, with the flank and 
+ * shedding level in use. The sideband shifts run up to the last bin, so no bin that the mask 
+ * passes is left in place, and the pruned FFT computes all passed bins, see rx_pruneset().
+ */
+static inline int dsp_passlo(int lowbin)
+{
+	int lo;
+	
+	lo = (dsp_shed >= SHED_MASK) ? lowbin : lowbin - dsp_flank/2;
+	return (lo < 1) ? 1 : lo;												// Never pass DC
+}
 
+static inline int dsp_passhi(int highbin)
+{
+	int hi;
+	
+	hi = (dsp_shed >= SHED_MASK) ? highbin : highbin + dsp_flank/2;
+	return (hi > BIN_FC-1) ? BIN_FC-1 : hi;
+}
 
+/*
+ * Raised cosine flank, gain of bin m in 0..flank-1: (1 - cos(pi*(m+1)/(flank+1)))/2
+ * The cosine is taken from the FFT sine table, at the nearest table angle.
+ */
+static int16_t mask_flank(int m, int flank)
+{
+	int j;
+	
+	j = ((m+1)*(FFT_SIZE/2) + (flank+1)/2)/(flank+1);						// Angle in table steps, < FFT_SIZE/2
+	return (int16_t)((32767 - fft_tab.sine[j+FFT_SIZE/4] + 1) >> 1);
+}
 
+/*
+ * Build the gain table for edges lowbin and highbin 
+ * Each edge bin is in the center of its flank, flanks that overlap are combined.
+ */
+static void dsp_mask(int lowbin, int highbin, int flank)
+{
+	int i, lo, hi, g;
+	
+	lo = lowbin - flank/2;													// First and last flank bin
+	hi = highbin + flank/2;
+	mask_lo = dsp_passlo(lowbin);
+	mask_hi = dsp_passhi(highbin);
+	for (i=mask_lo; i<=mask_hi; i++)
+	{
+		g = 32767;
+		if (i-lo < flank) g = mask_flank(i-lo, flank);						// Rising edge
+		if ((hi-i < flank) && (mask_flank(hi-i, flank) < g)) g = mask_flank(hi-i, flank);	// Falling edge
+		mask_gain[i] = g;
+	}
+	mask_key[0] = lowbin; mask_key[1] = highbin; mask_key[2] = flank; mask_key[3] = BIN_FC;
+}
 
 /*
  * This applies a bandpass filter to XI and XQ buffers
- * lowbin and highbin edges must be between 3 and FFT_SIZE/2 - 3
+ * lowbin and highbin edges must be between 1 and BIN_FC - 1
  * sign: <0 only LSB is passed
  *       >0 only USB is passed
  *       =0 LSB and USB are passed
- * Edge is a 7 bin raised cosine flank, i.e. 100Hz wide
- * Coefficients are: 0, 0.067, 0.25, 0.5, 0.75, 0.933, 1
+ * Edges are raised cosine flanks of dsp_flank bins, default 5, which gives 
+ * the coefficients 0, 0.067, 0.25, 0.5, 0.75, 0.933, 1
  *    where the edge bin is in the center of this flank
- * Note: maybe make slope less steep, e.g. 9 or 11 bins 
+ * Per block this is only a Q15 multiply on the passed bins, and nulling the rest.
+ * When shedding load (SHED_MASK) the flanks are dropped: the edge bins are hard limits and 
+ * the passed bins are not multiplied.
  */
 void  __not_in_flash_func(dsp_bandpass)(int lowbin, int highbin, int sign)
 {
-	int i, lo1, lo2, hi1, hi2;
+	int i, lo, hi, flank;
+	bool flat;
+	int16_t *gp, *xip, *xqp;
 	
-	if ((lowbin<3)||(highbin>(FFT_SIZE/2-3))||(highbin-lowbin<6)) return;
+	flat = (dsp_shed >= SHED_MASK);
+	if (flat)
+	{
+		lo = dsp_passlo(lowbin);
+		hi = dsp_passhi(highbin);
+	}
+	else
+	{
+		flank = dsp_flank;
+		if ((lowbin != mask_key[0]) || (highbin != mask_key[1]) || (flank != mask_key[2]) || (BIN_FC != mask_key[3]))
+			dsp_mask(lowbin, highbin, flank);
+		lo = mask_lo; hi = mask_hi;
+	}
 	
+	// Null all bins excluded from filter
 	XI_buf[0] = 0; XQ_buf[0] = 0; 	
+	for (i=1; i<lo; i++)                      { XI_buf[i] = 0; XQ_buf[i] = 0; }
+	for (i=hi+1; i<FFT_SIZE-hi; i++)          { XI_buf[i] = 0; XQ_buf[i] = 0; }
+	for (i=FFT_SIZE-lo+1; i<FFT_SIZE; i++)    { XI_buf[i] = 0; XQ_buf[i] = 0; }
 	
-	// Boundaries are inclusive
-	if (sign>=0) { lo1 = lowbin-2; lo2 = highbin+2; }
-	if (sign<=0) { hi1 = FFT_SIZE-highbin-2; hi2 = FFT_SIZE-lowbin+2; }
+	// Apply mask, USB 
+	if (sign < 0)
+		for (i=lo; i<=hi; i++) { XI_buf[i] = 0; XQ_buf[i] = 0; }
+	else if (!flat)
+	{
+		gp = &mask_gain[lo]; xip = &XI_buf[lo]; xqp = &XQ_buf[lo];
+		for (i=lo; i<=hi; i++)
+		{
+			*xip = ((int32_t)*xip * *gp + 0x4000) >> 15; xip++;
+			*xqp = ((int32_t)*xqp * *gp + 0x4000) >> 15; xqp++;
+			gp++;
+		}
+	}
 
-	// Null all bins excluded from filter
-	for (i=1; i<lo1; i++)          { XI_buf[i] = 0; XQ_buf[i] = 0; }
-	for (i=lo2+1; i<hi1; i++)      { XI_buf[i] = 0; XQ_buf[i] = 0; }
-	for (i=hi2+1; i<FFT_SIZE; i++) { XI_buf[i] = 0; XQ_buf[i] = 0; }
-
-	// Calculate edges, raised cosine
-	i=lo1;																	// USB
-	XI_buf[i] = XI_buf[i]*0.067; XQ_buf[i] = XQ_buf[i]*0.067; i++;
-	XI_buf[i] = XI_buf[i]*0.250; XQ_buf[i] = XQ_buf[i]*0.250; i++;
-	XI_buf[i] = XI_buf[i]*0.500; XQ_buf[i] = XQ_buf[i]*0.500; i++;
-	XI_buf[i] = XI_buf[i]*0.750; XQ_buf[i] = XQ_buf[i]*0.750; i++;
-	XI_buf[i] = XI_buf[i]*0.933; XQ_buf[i] = XQ_buf[i]*0.933; 
-	i=lo2;
-	XI_buf[i] = XI_buf[i]*0.067; XQ_buf[i] = XQ_buf[i]*0.067; i--;
-	XI_buf[i] = XI_buf[i]*0.250; XQ_buf[i] = XQ_buf[i]*0.250; i--;
-	XI_buf[i] = XI_buf[i]*0.500; XQ_buf[i] = XQ_buf[i]*0.500; i--;
-	XI_buf[i] = XI_buf[i]*0.750; XQ_buf[i] = XQ_buf[i]*0.750; i--;
-	XI_buf[i] = XI_buf[i]*0.933; XQ_buf[i] = XQ_buf[i]*0.933;
-	i=hi1;																	// LSB
-	XI_buf[i] = XI_buf[i]*0.067; XQ_buf[i] = XQ_buf[i]*0.067; i++;
-	XI_buf[i] = XI_buf[i]*0.250; XQ_buf[i] = XQ_buf[i]*0.250; i++;
-	XI_buf[i] = XI_buf[i]*0.500; XQ_buf[i] = XQ_buf[i]*0.500; i++;
-	XI_buf[i] = XI_buf[i]*0.750; XQ_buf[i] = XQ_buf[i]*0.750; i++;
-	XI_buf[i] = XI_buf[i]*0.933; XQ_buf[i] = XQ_buf[i]*0.933; 
-	i=hi2;
-	XI_buf[i] = XI_buf[i]*0.067; XQ_buf[i] = XQ_buf[i]*0.067; i--;
-	XI_buf[i] = XI_buf[i]*0.250; XQ_buf[i] = XQ_buf[i]*0.250; i--;
-	XI_buf[i] = XI_buf[i]*0.500; XQ_buf[i] = XQ_buf[i]*0.500; i--;
-	XI_buf[i] = XI_buf[i]*0.750; XQ_buf[i] = XQ_buf[i]*0.750; i--;
-	XI_buf[i] = XI_buf[i]*0.933; XQ_buf[i] = XQ_buf[i]*0.933;
+	// Apply mask, LSB
+	if (sign > 0)
+		for (i=lo; i<=hi; i++) { XI_buf[FFT_SIZE-i] = 0; XQ_buf[FFT_SIZE-i] = 0; }
+	else if (!flat)
+	{
+		gp = &mask_gain[lo]; xip = &XI_buf[FFT_SIZE-lo]; xqp = &XQ_buf[FFT_SIZE-lo];
+		for (i=lo; i<=hi; i++)
+		{
+			*xip = ((int32_t)*xip * *gp + 0x4000) >> 15; xip--;
+			*xqp = ((int32_t)*xqp * *gp + 0x4000) >> 15; xqp--;
+			gp++;
+		}
+	}
+}
+
+
+
+/*
+ * Noise reduction on the passband bins, after the sideband shift and the bandpass.
+ * Both sides of the spectrum are done, bins lo..hi and FFT_SIZE-hi..FFT_SIZE-lo, each bin has
+ * its own state, in the log2 domain in Q8:
+ * - S: the bin power, corrected for the FFT scaling, smoothed over blocks
+ * - N: minimum statistics, the lowest S over the current and the previous window of NR_WIN usec,
+ *   times 2 for the bias of a minimum. Speech and CW do not fill a bin for that long.
+ * The gain is a spectral subtraction G = 1 - beta*N/S, floored at Gmin, and smoothed over blocks.
+ * Using the smoothed S instead of the block power, and smoothing G, avoids most musical noise.
+ * The strength selects the over-subtraction beta and the floor Gmin.
+ * The state is reset when the bins change, so it takes one or two windows to settle again.
+ * Per bin this is a log2, an exp2 and two Q15 multiplies, on ~400 bins at most.
+ */
+#define NR_NBIN			(FFT_SIZE/4)										// Bins per side, > BIN_3000
+#define NR_WIN			750000												// usec
+#define NR_BIAS			(1<<8)												// Q8, log2 of 2
+const int16_t nr_beta[4] = {0, 16, 24, 32};									// Q4: -, 1, 1.5, 2
+const int16_t nr_gmin[4] = {32767, 16423, 8231, 4125};						// Q15: -, -6, -12, -18 dB
+int16_t nr_s[2][NR_NBIN], nr_cur[2][NR_NBIN], nr_prev[2][NR_NBIN];			// S, and N of the windows
+int16_t nr_g[2][NR_NBIN];													// Gain, Q15
+int nr_key[3] = {-1, -1, -1};												// lo, hi and rate of the state
+int nr_cnt = 0;																// Blocks in the current window
+
+void __not_in_flash_func(dsp_nrbins)(int lo, int hi, int scale)
+{
+	int i, k, s, beta, gmin, ls, rs;
+	int32_t x, n, g, mant;
+	bool init, wrap;
+	uint32_t p;
+	
+	if (lo < 1) lo = 1;
+	if (hi > NR_NBIN-1) hi = NR_NBIN-1;
+	init = (lo != nr_key[0]) || (hi != nr_key[1]) || (dsp_rate != nr_key[2]);
+	if (init)
+	{
+		nr_key[0] = lo; nr_key[1] = hi; nr_key[2] = dsp_rate;
+		nr_cnt = 0;
+	}
+	wrap = (++nr_cnt*BLK_US >= NR_WIN);
+	if (wrap) nr_cnt = 0;
+	beta = nr_beta[dsp_nr];
+	gmin = nr_gmin[dsp_nr];
+	ls = scale << 9;														// Q8 log2 of 4^scale
+	
+	for (s=0; s<2; s++)
+	{
+		for (i=lo; i<=hi; i++)
+		{
+			k = (s == 0) ? i : FFT_SIZE-i;
+			p = (uint32_t)(XI_buf[k]*XI_buf[k]) + (uint32_t)(XQ_buf[k]*XQ_buf[k]);
+			x = (log2_q16(p|1) >> 8) + ls;
+			if (init)
+			{
+				nr_s[s][i] = x; nr_cur[s][i] = x; nr_prev[s][i] = x; nr_g[s][i] = 32767;
+			}
+			
+			x = nr_s[s][i] + ((x - nr_s[s][i]) >> 2);						// S
+			nr_s[s][i] = x;
+			if (x < nr_cur[s][i]) nr_cur[s][i] = x;
+			n = MIN(nr_cur[s][i], nr_prev[s][i]) + NR_BIAS;					// N
+			if (wrap)
+			{
+				nr_prev[s][i] = nr_cur[s][i];
+				nr_cur[s][i] = x;
+			}
+			
+			n = n - x;														// log2 of N/S, at most 1
+			if (n > 0) n = 0;
+			exp2_q16((n<<8) + (13<<16), &mant, &rs);						// N/S in Q13
+			g = 32767 - ((beta*(mant >> rs)) >> 2);
+			if (g < gmin) g = gmin;
+			g = nr_g[s][i] + ((g - nr_g[s][i]) >> 1);
+			nr_g[s][i] = g;
+			XI_buf[k] = (XI_buf[k]*g + 0x4000) >> 15;
+			XQ_buf[k] = (XQ_buf[k]*g + 0x4000) >> 15;
+		}
+	}
+}
+
+
+/*
+ * Automatic notch for steady carriers in the passband, after the sideband shift and the bandpass.
+ * Detection is done on bins lo..hi of the side that the mode passes: the positive bins for USB, the
+ * negative bins for LSB, and for AM the sum of both, as a carrier may sit in either sideband.
+ * A bin is a candidate when it is a local maximum with at least NT_THR times the mean power of the
+ * bins at distance 3 and 4, i.e. a narrow peak.
+ * Per bin a counter goes up for a candidate and down twice as fast otherwise, a carrier gets a
+ * notch when its counter reaches NT_TON usec worth of blocks, and loses it below half of that.
+ * Speech harmonics move too much to build up such a count.
+ * Up to NOTCH_MAX notches are active, each is tapered over 5 bins with nt_taper[], on both sides
+ * of the spectrum, so the carrier and its image are both removed.
+ * Per block this is one pass over the passband bins plus 5 bins per notch.
+ */
+#define NT_THR			8													// Peak to neighbour power ratio, 9dB
+#define NT_TON			1000000												// usec
+const int16_t nt_taper[5] = {16384, 3277, 0, 3277, 16384};					// Q15 notch gain for bins k-2..k+2
+uint8_t nt_cnt[NR_NBIN];													// Persistence per bin
+volatile int nt_bin[NOTCH_MAX];												// Notched bins, 0 for none
+int nt_key[4] = {-1, -1, -1, -1};											// lo, hi, rate and mode of the state
+int nt_side = 1;															// Detection side, bit 0: positive, bit 1: negative bins
+
+static inline uint32_t nt_pwr(int k)
+{
+	uint32_t p = 0;
+	
+	if (nt_side & 1)
+		p += (uint32_t)(XI_buf[k]*XI_buf[k]) + (uint32_t)(XQ_buf[k]*XQ_buf[k]);
+	if (nt_side & 2)														// Each side < 2^31, the sum fits
+	{
+		k = FFT_SIZE - k;
+		p += (uint32_t)(XI_buf[k]*XI_buf[k]) + (uint32_t)(XQ_buf[k]*XQ_buf[k]);
+	}
+	return p;
+}
+
+void __not_in_flash_func(dsp_autonotch)(int lo, int hi)
+{
+	int i, j, k, on, c;
+	uint32_t p;
+	uint64_t ref;
+	
+	if (lo < 3) lo = 3;
+	if (hi > NR_NBIN-1) hi = NR_NBIN-1;
+	if ((lo != nt_key[0]) || (hi != nt_key[1]) || (dsp_rate != nt_key[2]) || (dsp_mode != nt_key[3]))
+	{
+		nt_key[0] = lo; nt_key[1] = hi; nt_key[2] = dsp_rate; nt_key[3] = dsp_mode;
+		for (i=0; i<NR_NBIN; i++) nt_cnt[i] = 0;
+		for (j=0; j<NOTCH_MAX; j++) nt_bin[j] = 0;
+	}
+	on = NT_TON/BLK_US;
+	if (on > 255) on = 255;
+	nt_side = (dsp_mode == MODE_LSB) ? 2 : ((dsp_mode == MODE_AM) ? 3 : 1);
+	
+	/* Detection, and release of notches */
+	for (i=lo+4; i<=hi-4; i++)
+	{
+		p = nt_pwr(i);
+		ref = (uint64_t)nt_pwr(i-4) + nt_pwr(i-3) + nt_pwr(i+3) + nt_pwr(i+4);
+		c = nt_cnt[i];
+		if ((p >= nt_pwr(i-1)) && (p >= nt_pwr(i+1)) && (4*(uint64_t)p > NT_THR*ref))
+			c = (c < 255) ? c+1 : 255;
+		else
+			c = (c > 2) ? c-2 : 0;
+		nt_cnt[i] = c;
+		if (c < on) continue;
+		
+		for (j=0; j<NOTCH_MAX; j++)											// New carrier, take a free slot
+			if (nt_bin[j] == i) break;
+		if (j < NOTCH_MAX) continue;
+		for (j=0; j<NOTCH_MAX; j++)
+			if (nt_bin[j] == 0) { nt_bin[j] = i; break; }
+	}
+	for (j=0; j<NOTCH_MAX; j++)
+		if ((nt_bin[j] != 0) && (nt_cnt[nt_bin[j]] < on/2)) nt_bin[j] = 0;
+	
+	/* Apply the notches */
+	for (j=0; j<NOTCH_MAX; j++)
+	{
+		if (nt_bin[j] == 0) continue;
+		for (i=-2; i<=2; i++)
+		{
+			k = nt_bin[j] + i;
+			XI_buf[k] = (XI_buf[k]*nt_taper[i+2] + 0x4000) >> 15;
+			XQ_buf[k] = (XQ_buf[k]*nt_taper[i+2] + 0x4000) >> 15;
+			k = FFT_SIZE - k;
+			XI_buf[k] = (XI_buf[k]*nt_taper[i+2] + 0x4000) >> 15;
+			XQ_buf[k] = (XQ_buf[k]*nt_taper[i+2] + 0x4000) >> 15;
+		}
+	}
+}
+
+
+/*
+ * S-meter levels from the forward FFT spectrum, before the sideband shift, see smtr_update()
+ * The passband is taken around BIN_FC, as selected by the mode.
+ * The noise floor is the lowest mean bin power of the SMTR_SEG bin segments outside the passband,
+ * so other signals in the window do not raise it. Segments at DC and beyond 80% of Nyquist, where
+ * the decimator rolls off, are skipped. The floor is scaled to the nr of passband bins, and
+ * corrected for the bias of taking a minimum.
+ * After a pruned FFT, pr is its bin set and only fully computed segments are used. These are
+ * the passband image and the bins at multiples of FFT_SIZE/4 from it, so there are always some.
+ * Bin power is xi^2+xq^2 < 2^31, the sums are 64 bit. The mean power per sample is the sum 
+ * over the bins, times 4^scale for the FFT scaling, divided by FFT_SIZE^2 (Parseval).
+ */
+#define SMTR_SEG		16
+#define SMTR_NFB		52429												// Log2 Q16 of 1.74: the minimum of ~50 segment means reads 2.4dB low on noise
+static void __not_in_flash_func(smtr_bins)(int scale, const fft_prune_t *pr)
+{
+	int i, k, lo, hi, edge;
+	uint64_t pass, seg, nmin;
+	int32_t exp;
+	
+	switch (dsp_mode)
+	{
+	case MODE_USB: lo = BIN_FC+BIN_100;  hi = BIN_FC+BIN_3000; break;
+	case MODE_LSB: lo = BIN_FC-BIN_3000; hi = BIN_FC-BIN_100;  break;
+	case MODE_AM:  lo = BIN_FC-BIN_3000; hi = BIN_FC+BIN_3000; break;
+	default:       lo = BIN_FC-BIN_300;  hi = BIN_FC+BIN_300;  break;
+	}
+	pass = 0;
+	for (i=lo; i<=hi; i++)
+		pass += (uint32_t)(XI_buf[i]*XI_buf[i]) + (uint32_t)(XQ_buf[i]*XQ_buf[i]);
+	
+	edge = (4*FFT_SIZE)/10;													// 80% of Nyquist
+	nmin = UINT64_MAX;
+	for (k=SMTR_SEG; k<FFT_SIZE-SMTR_SEG; k+=SMTR_SEG)
+	{
+		if ((k+SMTR_SEG > edge) && (k < FFT_SIZE-edge)) continue;			// Roll-off
+		if ((k+SMTR_SEG > lo) && (k <= hi)) continue;						// Passband
+		if (pr != NULL)														// Pruned FFT, only computed bins
+		{
+			for (i=k; (i<k+SMTR_SEG) && FFT_PBIN(pr, i); i++) ;
+			if (i < k+SMTR_SEG) continue;
+		}
+		seg = 0;
+		for (i=k; i<k+SMTR_SEG; i++)
+			seg += (uint32_t)(XI_buf[i]*XI_buf[i]) + (uint32_t)(XQ_buf[i]*XQ_buf[i]);
+		if (seg < nmin) nmin = seg;
+	}
+	
+	exp = (2*scale - 2*FFT_ORDER)<<16;
+	smtr_update(log2_q16_64(pass) + exp, log2_q16_64((nmin*(hi-lo+1))/SMTR_SEG) + exp + SMTR_NFB);
+}
+
+
+
+/*
+ * Spectrum frame for export, from the forward FFT spectrum before the sideband shift, see dsp.c
+ * The FFT_SIZE bins are reduced to SPEC_NBIN by taking the peak power of each group, so a narrow 
+ * carrier shows at its level. The frame starts at -Nyquist, i.e. bin FFT_SIZE/2.
+ * The level is relative to full scale like the S-meter: a carrier in a single bin reads its dBFS.
+ * f is the slot to fill, taken with spec_slot() before the FFT, see rx().
+ */
+#define SPEC_GRP		(FFT_SIZE/SPEC_NBIN)
+static void __not_in_flash_func(spec_bins)(spec_frame_t *f, int scale)
+{
+	int i, j, k, v;
+	uint32_t p, pk;
+	int32_t exp;
+	
+	exp = ((2*scale - 2*FFT_ORDER)<<16) - SMTR_FS;
+	k = FFT_SIZE/2;
+	for (j=0; j<SPEC_NBIN; j++)
+	{
+		pk = 0;
+		for (i=0; i<SPEC_GRP; i++)
+		{
+			p = (uint32_t)(XI_buf[k]*XI_buf[k]) + (uint32_t)(XQ_buf[k]*XQ_buf[k]);
+			if (p > pk) pk = p;
+			k = (k+1) & (FFT_SIZE-1);
+		}
+		v = SMTR_DB(log2_q16(pk|1) + exp)/10 + SPEC_DB0;
+		f->db[j] = (v < 0) ? 0 : ((v > 255) ? 255 : v);
+	}
+	f->seq = spec_seq;
+	f->rate = dsp_rate;
+	spec_commit();
 }
 
 
 
+/*
+ * Pruned forward FFT: only the bins that the sideband shift and the S-meter read for the mode.
+ * That is the passband around BIN_FC, and its mirror around -BIN_FC which the shift also reads.
+ * The passband includes the flanks of the bandpass, see dsp_passlo() and dsp_passhi(): a bin 
+ * that is not computed holds a leftover of the FFT passes, which the mask would pass.
+ * It is used when the spectrum export and the channels do not need the other bins, i.e. when the 
+ * export ring is full or shed, and no channel runs.
+ * The saving is in the last stages, and grows with the rate: at RATE_62 the passband is a 
+ * small part of the spectrum, at RATE_15 about all columns are still needed.
+ * The set is rebuilt when mode, rate or passband change, the latter with the flank or shedding level.
+ * The pruned transform tests a bit per butterfly column, in the last stage that is one test per 
+ * butterfly. This costs more than it saves when few butterflies are skipped: for USB, LSB and AM 
+ * at RATE_15 it is 0 or 1%, at RATE_31 4%. So it is only used when the set skips at least 
+ * 1/PRUNE_DIV of the butterflies, counted when it is built. This leaves CW at all rates and 
+ * USB and LSB at RATE_62. See tests/bench_fft.c for the figures per mode and rate.
+ */
+#define PRUNE_DIV		16
+fft_prune_t rx_prune;
+int prune_key[3] = {-1, -1, -1};											// Rate, lo and hi of rx_prune
+bool rx_pruned = false;														// rx_prune is worth using
+
+void rx_pruneset(void)
+{
+	int lo, hi, pl, ph;
+	
+	pl = dsp_passlo(BIN_100);
+	ph = dsp_passhi(BIN_3000);
+	switch (dsp_mode)
+	{
+	case MODE_USB: lo = pl;       hi = ph;       break;
+	case MODE_LSB: lo = -ph;      hi = -pl;      break;
+	case MODE_AM:  lo = -ph;      hi = ph;       break;
+	default:       lo = -BIN_900; hi = BIN_900;  break;						// Covers the CW flanks
+	}
+	if ((prune_key[0] == dsp_rate) && (prune_key[1] == lo) && (prune_key[2] == hi)) return;
+	fix_fft_pclear(&rx_prune);
+	fix_fft_padd(&rx_prune, BIN_FC+lo, BIN_FC+hi);
+	fix_fft_padd(&rx_prune, -BIN_FC-hi, -BIN_FC-lo);
+	rx_pruned = (fix_fft_pskip(&rx_prune) >= (FFT_ORDER/2)*(FFT_SIZE/4)/PRUNE_DIV);
+	prune_key[0] = dsp_rate; prune_key[1] = lo; prune_key[2] = hi;
+}
+
+
+
+/*
+ * Channelizer: up to CHAN_MAX extra receivers, demodulated from the forward FFT spectrum of the 
+ * main receiver, before its sideband shift. Each has its own mode and offset, see dsp_setchan().
+ * A channel takes the bins of its passband, masked with raised cosine flanks like dsp_bandpass(),
+ * into an audio spectrum A of M = FFT_SIZE>>rate bins. An iFFT of M bins at the same bin step 
+ * gives the audio at S_RATE, so no decimation is needed, and its newest half is one audio block.
+ * Per audio bin i the USB bin is Fc+i and the LSB bin Fc-i, conjugated, AM takes both. CW puts
+ * the carrier on 900Hz with 600Hz bandwidth, like the main receiver.
+ * A is made conjugate symmetric, A[M-i] = A*[i], so its iFFT is real. Two channels then share 
+ * one iFFT: Z = A + jB gives channel A in the Re and channel B in the Im output. So a pair of
+ * channels costs one iFFT of M points and the bins of two passbands, the forward FFT is shared.
+ * The bins are halved, which makes the gain equal to that of the main receiver, and Z can not overflow.
+ * The channel carrier is rounded to an even bin, like BIN_FC, so the overlapping frames continue 
+ * without a phase jump: the offset has steps of 2 bins, 30Hz at RATE_15.
+ * A channel is skipped when its passband is not within 80% of Nyquist.
+ * The passband power gives the channel level, like the S-meter.
+ * The buffers take 10kB of RAM for FFT_SIZE 1024, the audio of all channels is kept until the mix.
+ */
+#define CHAN_NPAIR		(CHAN_MAX/2)
+int16_t CH_re[FFT_SIZE] __attribute__((aligned(4)));						// Spectrum of a pair, then its audio
+int16_t CH_im[FFT_SIZE] __attribute__((aligned(4)));
+int16_t ch_aud[CHAN_MAX][BUFSIZE] __attribute__((aligned(4)));				// Audio block per channel
+int     ch_scale[CHAN_NPAIR];												// iFFT scaling per pair, -1 when none
+int32_t ch_mix[BUFSIZE];													// Main and channel audio, see rx()
+
+#define CH_SAT(x)		((x) > 32767 ? 32767 : ((x) < -32768 ? -32768 : (x)))
+
+/*
+ * Add the passband of channel c to the pair spectrum, as A (im false) or B (im true)
+ * Returns false when the channel is off or out of range.
+ */
+static bool __not_in_flash_func(chan_bins)(int c, bool im, int scale)
+{
+	int i, j, k, m, fc, a, lo, hi, flank, fs, mode, v;
+	int32_t g, ur, ui, lr, li, ar, ai;
+	uint64_t pw;
+	
+	mode = dsp_chan[c];
+	if (mode == CHAN_OFF)
+	{
+		chan_lvl[c] = -1200;
+		return false;
+	}
+	m = FFT_SIZE>>dsp_rate;
+	fs = S_RATE<<dsp_rate;
+	k = (dsp_choff[c]*FFT_SIZE + ((dsp_choff[c] < 0) ? -fs : fs)) / (2*fs);	// Offset in bin pairs, rounded
+	fc = BIN_FC + 2*k;
+	if (mode == MODE_CW) { a = BIN_900; lo = BIN_900-BIN_300; hi = BIN_900+BIN_300; }
+	else                 { a = 0;       lo = BIN_100;         hi = BIN_3000; }
+	flank = (dsp_shed >= SHED_MASK) ? 0 : dsp_flank;
+	lo -= flank/2; hi += flank/2;											// First and last flank bin
+	if (lo < 1) lo = 1;
+	if (hi > m/2-1) hi = m/2-1;
+	if ((fc+hi-a > (4*FFT_SIZE)/10) || (fc-hi < -(4*FFT_SIZE)/10))
+	{
+		chan_lvl[c] = -1200;
+		return false;
+	}
+	
+	pw = 0;
+	for (i=lo; i<=hi; i++)
+	{
+		// Upper and lower sideband bins
+		j = (fc+i-a) & (FFT_SIZE-1);
+		ur = XI_buf[j]; ui = XQ_buf[j];
+		j = (fc-i) & (FFT_SIZE-1);
+		lr = XI_buf[j]; li = XQ_buf[j];
+		switch (mode)
+		{
+		case MODE_LSB: ar = lr;      ai = -li;      pw += (uint32_t)(lr*lr) + (uint32_t)(li*li); break;
+		case MODE_AM:  ar = ur + lr; ai = ui - li;  pw += (uint32_t)(ur*ur) + (uint32_t)(ui*ui) + (uint32_t)(lr*lr) + (uint32_t)(li*li); break;
+		default:       ar = ur;      ai = ui;       pw += (uint32_t)(ur*ur) + (uint32_t)(ui*ui); break;
+		}
+		
+		// Mask, halved
+		g = 16384;
+		if (i-lo < flank) g = mask_flank(i-lo, flank) >> 1;
+		if ((hi-i < flank) && ((mask_flank(hi-i, flank) >> 1) < g)) g = mask_flank(hi-i, flank) >> 1;
+		ar = (ar*g + 0x4000) >> 15;
+		ai = (ai*g + 0x4000) >> 15;
+		
+		// Z[i] and Z[M-i], with A[M-i] = A*[i]
+		if (im)
+		{
+			v = CH_re[i] - ai;   CH_re[i] = CH_SAT(v);   v = CH_im[i] + ar;   CH_im[i] = CH_SAT(v);
+			v = CH_re[m-i] + ai; CH_re[m-i] = CH_SAT(v); v = CH_im[m-i] + ar; CH_im[m-i] = CH_SAT(v);
+		}
+		else
+		{
+			v = CH_re[i] + ar;   CH_re[i] = CH_SAT(v);   v = CH_im[i] + ai;   CH_im[i] = CH_SAT(v);
+			v = CH_re[m-i] + ar; CH_re[m-i] = CH_SAT(v); v = CH_im[m-i] - ai; CH_im[m-i] = CH_SAT(v);
+		}
+	}
+	
+	v = SMTR_DB(log2_q16_64(pw) + ((2*scale - 2*FFT_ORDER)<<16) - SMTR_FS);
+	chan_lvl[c] += (v - chan_lvl[c]) >> 2;
+	return true;
+}
+
+/*
+ * Demodulate the active channel pairs into ch_aud[], the scale of a pair is in ch_scale[]
+ */
+void __not_in_flash_func(chan_rx)(int scale)
+{
+	int p, i, m, n;
+	bool on;
+	
+	m = FFT_SIZE>>dsp_rate;
+	n = m/2;
+	for (p=0; p<CHAN_NPAIR; p++)
+	{
+		if ((dsp_chan[2*p] == CHAN_OFF) && (dsp_chan[2*p+1] == CHAN_OFF)) continue;
+		for (i=0; i<m; i++) { CH_re[i] = 0; CH_im[i] = 0; }
+		on = chan_bins(2*p, false, scale);
+		on = chan_bins(2*p+1, true, scale) || on;
+		if (!on) continue;
+		ch_scale[p] = fix_fft_n(CH_re, CH_im, FFT_ORDER-dsp_rate, true);
+		for (i=0; i<n; i++) { ch_aud[2*p][i] = CH_re[n+i]; ch_aud[2*p+1][i] = CH_im[n+i]; }
+	}
+}
+
+
+
+/*
+ * Audio interpolation at RATE_15: the passband is below S_RATE/4, so the RX inverse FFT takes
+ * half the bins, and gives the audio at S_RATE/2. A halfband filter interpolates it to S_RATE:
+ * the even outputs are the input samples, the odd ones the sum of RXI_NTAP symmetric tap pairs.
+ * It passes 0..3.15kHz within 0.01dB and stops the images from 4.7kHz by 59dB, Kaiser window 
+ * with beta 5.65, 39 taps. The taps are in Q14 so the sum stays within 32 bits, it is not 
+ * saturated: with the odd taps adding up to 2.2 the output can exceed int16, ch_mix is int32.
+ * The delay line holds the last 2*RXI_NTAP-1 samples of the previous block, so the output lags 
+ * RXI_NTAP-1 samples at S_RATE/2, 1.2msec.
+ */
+#define RXI_NTAP		10
+const int16_t rxi_tap[RXI_NTAP] = {10356, -3260, 1742, -1041, 632, -372, 206, -102, 42, -11};
+int16_t rxi_line[2*RXI_NTAP-1 + BUFSIZE/2];									// History, then the new block
+
+static void __not_in_flash_func(rx_interp)(const int16_t *x, int32_t *y)
+{
+	int j, k;
+	int32_t a;
+	int16_t *lp;
+	
+	memcpy(&rxi_line[2*RXI_NTAP-1], x, (BUFSIZE/2)*sizeof(int16_t));
+	for (j=0; j<BUFSIZE/2; j++)
+	{
+		lp = &rxi_line[j+RXI_NTAP-1];
+		for (a=0, k=0; k<RXI_NTAP; k++)
+			a += rxi_tap[k]*(lp[-k] + lp[k+1]);
+		y[2*j]   = lp[0];
+		y[2*j+1] = (a + 0x2000) >> 14;
+	}
+	memmove(rxi_line, &rxi_line[BUFSIZE/2], (2*RXI_NTAP-1)*sizeof(int16_t));
+}
+
+
 /** CORE1: RX branch **/
 /*
  * Execute RX branch signal processing
- * max time to spend is <32ms (BUFSIZE*TIM_US)
+ * max time to spend is <32ms (BUFSIZE*TIM_US), at RATE_15
  * The pre-processed I/Q samples are passed in I_BUF and Q_BUF
- * The calculated A samples are passed in A_BUF
+ * The calculated A samples are passed in the audio DAC output block
  */
 volatile int scale0;
 volatile int scale1; 
 bool __not_in_flash_func(rx)(void) 
 {
 	int b;
-	int i;
-	int16_t *ip, *qp, *ap, *xip, *xqp;
-	int16_t peak;
+	int i, m, n, p, r, s, h, hi, rs;
+	int32_t mant, x;
+	uint32_t peak;
+	fft_frame_t frame;
+	spec_frame_t *sf;
+	const fft_prune_t *pr;
+	uint16_t *ap;
 		
-	b = dsp_active;															// Point to Active sample buffer
+	fft_bins();
+	tx_env = 0;																// Next TX block is a key down
 	
-	/*** Copy saved I/Q buffers to FFT filter buffer ***/
+	/*** Saved I/Q buffers are the FFT input frame ***/
+	b = dsp_active;															// Point to Active sample buffer
 	if (++b > 2) b = 0;														// Point to Old Saved sample buffer
-	ip = &I_buf[b][0]; xip = &XI_buf[0];
-	qp = &Q_buf[b][0]; xqp = &XQ_buf[0];
-	for (i=0; i<BUFSIZE; i++)
-	{
-		*xip++ = *ip++;
-		*xqp++ = *qp++;
-	}
+	frame.re[0] = I_buf[b]; frame.im[0] = Q_buf[b];
+	FFT_WORK_RX(b);
 	if (++b > 2) b = 0;														// Point to New Saved sample buffer
-	ip = &I_buf[b][0]; xip = &XI_buf[BUFSIZE];
-	qp = &Q_buf[b][0]; xqp = &XQ_buf[BUFSIZE];
-	for (i=0; i<BUFSIZE; i++)
+	frame.re[1] = I_buf[b]; frame.im[1] = Q_buf[b];
+	nco_iq(I_buf[b], Q_buf[b], BUFSIZE);									// Fine tuning, once per buffer
+
+	
+	/*** Execute FFT, pruned when only the demodulator needs the spectrum ***/
+	sf = (dsp_shed < SHED_SPEC) ? spec_slot() : NULL;						// Spectrum export slot, NULL when full
+	for (i=0, n=0; i<CHAN_MAX; i++) if (dsp_chan[i] != CHAN_OFF) n++;
+	if (dsp_shed >= SHED_NR) n = 0;											// Channels are shed
+	PROF_START(PROF_FFT);
+	pr = NULL;
+	if ((sf == NULL) && (n == 0))
 	{
-		*xip++ = *ip++;
-		*xqp++ = *qp++;
+		rx_pruneset();
+		if (rx_pruned) pr = &rx_prune;
 	}
-
+	if (pr != NULL)
+		scale0 = fix_fft_prune(&XI_buf[0], &XQ_buf[0], &frame, pr);
+	else
+		scale0 = fix_fft_frame(&XI_buf[0], &XQ_buf[0], &frame);				// Frequency domain filter input
+	PROF_STOP(PROF_FFT);
+	smtr_bins(scale0, pr);													// Passband level and noise floor
+	if (sf != NULL)
+		spec_bins(sf, scale0);												// Spectrum export
 	
-	/*** Execute FFT ***/
-	scale0 = fix_fft(&XI_buf[0], &XQ_buf[0], false);						// Frequency domain filter input
+	/*** Extra receiver channels, from the same spectrum ***/
+	for (p=0; p<CHAN_NPAIR; p++) ch_scale[p] = -1;
+	if (n > 0)
+	{
+		PROF_START(PROF_CHAN);
+		chan_rx(scale0);
+		PROF_STOP(PROF_CHAN);
+	}
 	
 	
 	/*** Shift and filter sidebands ***/
+	PROF_START(PROF_SHIFT);
 	// At this point USB and LSB surround Fc
 	// The desired sidebands must be shifted to their target positions around 0
 	// Pos USB to bin 0 and Neg USB to bin FFT_SIZE, or
 	// Neg LSB to bin 0 and Pos LSB to bin FFT_SIZE, or
 	// Pos USB to bin 0 and Pos LSB to bin FFT_SIZE
+	// The shifts cover all bins that the bandpass passes, up to hi < BIN_FC. They are in place,
+	// so a source bin is read before its position is written: when hi > BIN_FC/2 the target bins
+	// 1..hi overlap the sources BIN_FC-hi..BIN_FC-1, and FFT_SIZE-hi..FFT_SIZE-1 overlap 
+	// FFT_SIZE-BIN_FC+1..FFT_SIZE-BIN_FC+hi. The bins around BUFSIZE are free, the bandpass nulls them.
 	XI_buf[0] = 0;	XQ_buf[0] = 0;											// No DC
+	hi = dsp_passhi(BIN_3000);
 	switch (dsp_mode)
 	{
 	case MODE_USB:
-		// Shift Fc + USB to 0Hz + USB
-		for (i=1; i<BIN_3000; i++)
+		// Shift Fc + USB to 0Hz + USB, sources are beyond the targets
+		for (i=1; i<=hi; i++)
 		{
 			XI_buf[i]          = XI_buf[i+BIN_FC]; 
 			XI_buf[FFT_SIZE-i] = XI_buf[FFT_SIZE-BIN_FC-i];
@@ -229,26 +846,35 @@ bool __not_in_flash_func(rx)(void)
 		dsp_bandpass(BIN_100, BIN_3000, 0);
 		break;
 	case MODE_LSB:
-		// Shift Fc - LSB to 0Hz - LSB
-		for (i=1; i<BIN_3000; i++)
+		// Shift Fc - LSB to 0Hz - LSB, via the free bins below BUFSIZE
+		for (i=1; i<=hi; i++)
 		{
 			XI_buf[BUFSIZE-i]  = XI_buf[BIN_FC-i]; 
-			XI_buf[i]          = XI_buf[FFT_SIZE-BIN_FC+i];
-			XI_buf[FFT_SIZE-i] = XI_buf[BUFSIZE-i];
 			XQ_buf[BUFSIZE-i]  = XQ_buf[BIN_FC-i]; 
+		}
+		for (i=1; i<=hi; i++)
+		{
+			XI_buf[i]          = XI_buf[FFT_SIZE-BIN_FC+i];
 			XQ_buf[i]          = XQ_buf[FFT_SIZE-BIN_FC+i];
+		}
+		for (i=1; i<=hi; i++)
+		{
+			XI_buf[FFT_SIZE-i] = XI_buf[BUFSIZE-i];
 			XQ_buf[FFT_SIZE-i] = XQ_buf[BUFSIZE-i];
 		}
 		// Bandpass DSB (2x LSB)
 		dsp_bandpass(BIN_100, BIN_3000, 0);
 		break;
 	case MODE_AM:
-		// Shift the rest to the right place
-		for (i=1; i<BIN_3000; i++)
+		// Shift the LSB to the negative bins first, then the USB over its source bins
+		for (i=1; i<=hi; i++)
 		{
 			XI_buf[FFT_SIZE-i] = XI_buf[BIN_FC-i]; 
-			XI_buf[i]          = XI_buf[BIN_FC+i];
 			XQ_buf[FFT_SIZE-i] = XQ_buf[BIN_FC-i]; 
+		}
+		for (i=1; i<=hi; i++)
+		{
+			XI_buf[i]          = XI_buf[BIN_FC+i];
 			XQ_buf[i]          = XQ_buf[BIN_FC+i];
 		}
 		// Bandpass DSB (LSB + USB)
@@ -267,169 +893,215 @@ bool __not_in_flash_func(rx)(void)
 		dsp_bandpass(BIN_900-BIN_300, BIN_900+BIN_300, 0);
 		break;
 	}
+	PROF_STOP(PROF_SHIFT);
 
 	
-	/*** Execute inverse FFT ***/
-	scale1 = fix_fft(&XI_buf[0], &XQ_buf[0], true);
-
+	/*** Auto-notch, not in CW where the carrier is the signal ***/
+	if ((dsp_notch != 0) && (dsp_mode != MODE_CW) && (dsp_shed < SHED_NR))
+	{
+		PROF_START(PROF_NOTCH);
+		dsp_autonotch(BIN_100, BIN_3000);
+		PROF_STOP(PROF_NOTCH);
+	}
+	
+	/*** Noise reduction, on the passband bins ***/
+	if ((dsp_nr != NR_OFF) && (dsp_shed < SHED_NR))
+	{
+		PROF_START(PROF_NR);
+		if (dsp_mode == MODE_CW)
+			dsp_nrbins(BIN_900-BIN_300, BIN_900+BIN_300, scale0);
+		else
+			dsp_nrbins(BIN_100, BIN_3000, scale0);
+		PROF_STOP(PROF_NR);
+	}
 
-	/*** Export FFT buffer to A ***/
-	b = dsp_active;															// Assume active buffer not changed, i.e. no overruns
-	if (++b > 2) b = 0;														// Point to oldest (will be next for output)
-	ap = &A_buf[b][0]; xip = &XI_buf[BUFSIZE];
-	for (i=0; i<BUFSIZE; i++)
+	
+	/*** Execute inverse FFT, decimating to S_RATE, at RATE_15 to S_RATE/2 ***/
+	// The bins are all below m/2, so folding the negative bins onto m-1..m/2+1 is exact
+	// At RATE_15 they are below BIN_FC = FFT_SIZE/4, so m is FFT_SIZE/2 there, see rx_interp()
+	PROF_START(PROF_IFFT);
+	r = (dsp_rate == RATE_15) ? 1 : dsp_rate;
+	m = FFT_SIZE>>r;
+	for (i=1; i<m/2; i++)
 	{
-		*ap++ = *xip++;														// Copy newest results
+		XI_buf[m-i] = XI_buf[FFT_SIZE-i];
+		XQ_buf[m-i] = XQ_buf[FFT_SIZE-i];
 	}
+	scale1 = fix_fft_n(&XI_buf[0], &XQ_buf[0], FFT_ORDER-r, true);
+	PROF_STOP(PROF_IFFT);
 
 
-	/*** Scale down into DAC_RANGE! ***/	
-	peak = 256;
-	for (i=0; i<BUFSIZE; i++)									
+	/*** Mix the newest half of the frame with the channels ***/
+	PROF_START(PROF_OUT);
+	// The iFFT output is the input times FFT_SIZE, scaled down by 2^(scale0+scale1)
+	// With channels the sum is taken at the largest scale s, plus 2 bits headroom for up to 5 sources
+	n = BUFSIZE>>dsp_rate;
+	if (dsp_rate == RATE_15)
+		rx_interp(&XI_buf[m/2], ch_mix);
+	else
+		for (i=0; i<n; i++) ch_mix[i] = XI_buf[n+i];
+	s = scale1; h = 0;
+	for (p=0; p<CHAN_NPAIR; p++)
+		if (ch_scale[p] >= 0) { s = MAX(s, ch_scale[p]); h = 2; }
+	s += h;
+	peak = 0;
+	for (i=0; i<n; i++)
 	{
-		A_buf[b][i] /= peak;
+		x = ch_mix[i] >> (s-scale1);
+		for (p=0; p<CHAN_NPAIR; p++)
+			if (ch_scale[p] >= 0) x += (ch_aud[2*p][i] + ch_aud[2*p+1][i]) >> (s-ch_scale[p]);
+		ch_mix[i] = x;
+		if (ABS(x) > peak) peak = ABS(x);
 	}
+	
+	/*** AGC, the output block is known here, so it can look ahead ***/
+	exp2_q16(dsp_agc(peak, scale0+s-FFT_ORDER), &mant, &rs);
+	
+	/*** Output, from the next buffer wrap ***/
+	ap = dac_abuf[dac_play^1];
+	for (i=0; i<n; i++)
+		ap[i] = X_OUT(AGC_MUL(ch_mix[i], mant, rs));
+	PROF_STOP(PROF_OUT);
 		
 	return true;
 }
 
 
 /** CORE1: TX branch **/
+/*
+ * The carrier for CW and AM is synthesized at BIN_FC, from the FFT sine table, see tab_sin() in dsp.c.
+ * Its phase at output sample i is taken from the frame, BIN_FC*(BUFSIZE+i), so it is coherent with
+ * the AM sidebands from the iFFT. BIN_FC is even for every rate and FFT_ORDER, so this phase also
+ * runs on without a jump from one block to the next.
+ * CW has a raised cosine rise of TX_RISE usec at key down, i.e. the first TX block after RX.
+ */
+/*
+ * CW: only the carrier is output, audio is not used so no FFT is needed
+ */
+static void __not_in_flash_func(tx_cw)(uint32_t *iqp)
+{
+	int i, k, n;
+	int32_t a;
+	
+	n = (TX_RISE*(S_RATE<<dsp_rate))/1000000;								// Rise time in samples
+	for (i=0; i<BUFSIZE; i++)
+	{
+		a = TX_CW;
+		if (tx_env < n)
+		{
+			a = (a*((32767 - tab_sin(tx_env*(FFT_SIZE/2)/n + FFT_SIZE/4)) >> 1)) >> 15;
+			tx_env++;
+		}
+		k = BIN_FC*(BUFSIZE+i);
+		iqp[i] = DAC_IQ(X_OUT((a*tab_sin(k+FFT_SIZE/4)) >> 15), X_OUT((a*tab_sin(k)) >> 15));
+	}
+}
+
 /*
  * Execute TX branch signal processing
- * max time to spend is <32ms (BUFSIZE*TIM_US)
+ * max time to spend is <32ms (BUFSIZE*TIM_US), at RATE_15
  * The pre-processed A samples are passed in A_BUF
- * The calculated I and Q samples are passed in I_BUF and Q_BUF
+ * The calculated I and Q samples are passed in the I/Q DAC output block
+ * The I/Q output is the analytic signal, so the spectrum holds only what is transmitted: 
+ * USB above BIN_FC, LSB below it, AM on both sides plus the carrier.
  */
 bool __not_in_flash_func(tx)(void) 
 {
 	int b;
-	int i;
-	int16_t *ip, *qp, *ap, *xip, *xqp;
-	int16_t peak;
+	int i, k, hi, rs;
+	int32_t mant, xi, xq, c;
+	fft_frame_t frame;
+	uint32_t *iqp;
 		
-	b = dsp_active;															// Point to Active sample buffer
-	
-	/*** Copy saved A buffers to FFT buffers, NULL Im. part ***/
-	if (++b > 2) b = 0;														// Point to Old Saved sample buffer
-	ap = &A_buf[b][0]; xip = &XI_buf[0];
-	xqp = &XQ_buf[0];
-	for (i=0; i<BUFSIZE; i++)
+	fft_bins();
+	iqp = dac_iqbuf[dac_play^1];
+	if (dsp_mode == MODE_CW)
 	{
-		*xip++ = *ip++;
-		*xqp++ = 0;
+		PROF_START(PROF_OUT);
+		tx_cw(iqp);
+		nco_dac(iqp, BUFSIZE);
+		PROF_STOP(PROF_OUT);
+		return true;
 	}
+	FFT_WORK_TX();
+	
+	/*** Saved A buffers are the FFT input frame, even samples in Re. and odd samples in Im. part ***/
+	b = dsp_active;															// Point to Active sample buffer
+	if (++b > 2) b = 0;														// Point to Old Saved sample buffer
+	frame.re[0] = &A_buf[b][0]; frame.im[0] = &A_buf[b][BUFSIZE/2];
 	if (++b > 2) b = 0;														// Point to New Saved sample buffer
-	ap = &A_buf[b][0]; xip = &XI_buf[BUFSIZE];
-	xqp = &XQ_buf[BUFSIZE];
-	for (i=0; i<BUFSIZE; i++)
-	{
-		*xip++ = *ip++;
-		*xqp++ = 0;
-	}
+	frame.re[1] = &A_buf[b][0]; frame.im[1] = &A_buf[b][BUFSIZE/2];
 
 	
-	/*** Execute FFT ***/
-	scale0 = fix_fft(&XI_buf[0], &XQ_buf[0], false);	
+	/*** Execute FFT, real input ***/
+	PROF_START(PROF_FFT);
+	scale0 = fix_fft_real(&XI_buf[0], &XQ_buf[0], &frame);	
+	PROF_STOP(PROF_FFT);
 	
 	
-	/*** Shift and filter sidebands ***/
+	/*** Filter and shift sidebands ***/
+	// The audio spectrum is conjugate symmetric, the positive bins are the USB and the negative
+	// bins the LSB. The bandpass keeps the wanted side, the shifts move it to BIN_FC, and clear
+	// the source bins up to hi, the last bin the bandpass passes. A target bin is always beyond 
+	// hi, or a cleared bin.
+	PROF_START(PROF_SHIFT);
 	XI_buf[0] = 0; XQ_buf[0] = 0;											// No DC
+	hi = dsp_passhi(BIN_3000);
 	switch (dsp_mode)
 	{
 	case MODE_USB:
-		// Bandpass Audio, USB only
 		dsp_bandpass(BIN_100, BIN_3000, 1);
-		// Shift USB up to to Fc, assumes Fc > bandwidth
-		for (i=1; i<BIN_3000; i++)
-		{
-			XI_buf[BIN_FC+i] = XI_buf[i];
-			XQ_buf[BIN_FC+i] = XQ_buf[i];
-			XI_buf[i] = 0;	
-			XQ_buf[i] = 0;
-		}
-		for (i=1; i<BIN_3000; i++)
+		for (i=1; i<=hi; i++)												// Audio +f to Fc+f
 		{
-			XI_buf[FFT_SIZE-BIN_FC-i] = XI_buf[BIN_FC+i];
-			XQ_buf[FFT_SIZE-BIN_FC-i] = XQ_buf[BIN_FC+i];
+			XI_buf[BIN_FC+i] = XI_buf[i]; XI_buf[i] = 0;
+			XQ_buf[BIN_FC+i] = XQ_buf[i]; XQ_buf[i] = 0;
 		}
 		break;
 	case MODE_LSB:
-		// Bandpass Audio, LSB only
 		dsp_bandpass(BIN_100, BIN_3000, -1);
-		// Shift LSB up to Fc
-		for (i=1; i<BIN_3000; i++)
+		for (i=1; i<=hi; i++)												// Audio -f to Fc-f
 		{
-			XI_buf[BIN_FC-i] = XI_buf[FFT_SIZE-i];
-			XQ_buf[BIN_FC-i] = XQ_buf[FFT_SIZE-i];
-			XI_buf[FFT_SIZE-i] = 0;
-			XQ_buf[FFT_SIZE-i] = 0;
-		}
-		for (i=1; i<BIN_3000; i++)
-		{
-			XI_buf[FFT_SIZE-BIN_FC+i] = XI_buf[BIN_FC-i];
-			XQ_buf[FFT_SIZE-BIN_FC+i] = XQ_buf[BIN_FC-i];
+			XI_buf[BIN_FC-i] = XI_buf[FFT_SIZE-i]; XI_buf[FFT_SIZE-i] = 0;
+			XQ_buf[BIN_FC-i] = XQ_buf[FFT_SIZE-i]; XQ_buf[FFT_SIZE-i] = 0;
 		}
 		break;
 	case MODE_AM:
-		// Bandpass Audio
 		dsp_bandpass(BIN_100, BIN_3000, 0);
-		// Shift DSB up to Fc
-		for (i=1; i<BIN_3000; i++)
+		for (i=1; i<=hi; i++)												// Audio +f to Fc+f first
 		{
-			XI_buf[BIN_FC+i] = XI_buf[i];
-			XQ_buf[BIN_FC+i] = XQ_buf[i];
-			XI_buf[i] = 0;	
-			XQ_buf[i] = 0;
-			XI_buf[BIN_FC-i] = XI_buf[FFT_SIZE-i];
-			XQ_buf[BIN_FC-i] = XQ_buf[FFT_SIZE-i];
-			XI_buf[FFT_SIZE-i] = 0;
-			XQ_buf[FFT_SIZE-i] = 0;
+			XI_buf[BIN_FC+i] = XI_buf[i]; XI_buf[i] = 0;
+			XQ_buf[BIN_FC+i] = XQ_buf[i]; XQ_buf[i] = 0;
 		}
-		for (i=1; i<BIN_3000; i++)
+		for (i=1; i<=hi; i++)												// Then audio -f to Fc-f
 		{
-			XI_buf[FFT_SIZE-BIN_FC-i] = XI_buf[BIN_FC+i];
-			XQ_buf[FFT_SIZE-BIN_FC-i] = XQ_buf[BIN_FC+i];
-			XI_buf[FFT_SIZE-BIN_FC+i] = XI_buf[BIN_FC-i];
-			XQ_buf[FFT_SIZE-BIN_FC+i] = XQ_buf[BIN_FC-i];
+			XI_buf[BIN_FC-i] = XI_buf[FFT_SIZE-i]; XI_buf[FFT_SIZE-i] = 0;
+			XQ_buf[BIN_FC-i] = XQ_buf[FFT_SIZE-i]; XQ_buf[FFT_SIZE-i] = 0;
 		}
-		break;
-	case MODE_CW:
-
-		// Create a carrier on 900Hz from Fc
-
 		break;
 	}
+	PROF_STOP(PROF_SHIFT);
 
 	
 	/*** Execute inverse FFT ***/
+	PROF_START(PROF_IFFT);
 	scale1 = fix_fft(&XI_buf[0], &XQ_buf[0], true);
+	PROF_STOP(PROF_IFFT);
 
 
-	/*** Export FFT buffer to I and Q ***/
-	b = dsp_active;															// Assume active buffer not changed, i.e. no overruns
-	if (++b > 2) b = 0;														// Point to oldest (will be next for output)
-	qp = &Q_buf[b][0]; xqp = &XQ_buf[BUFSIZE];
-	ip = &I_buf[b][0]; xip = &XI_buf[BUFSIZE];
+	/*** Output the newest half of the frame, from the next buffer wrap ***/
+	// Fixed gain, corrected for the FFT scaling like in RX, plus the AM carrier
+	PROF_START(PROF_OUT);
+	exp2_q16(TX_GAIN + ((scale0+scale1-FFT_ORDER)<<16), &mant, &rs);
+	c = (dsp_mode == MODE_AM) ? TX_AM : 0;
 	for (i=0; i<BUFSIZE; i++)
 	{
-		*qp++ = *xqp++;														// Copy newest results
-		*ip++ = *xip++;														// Copy newest results
-	}
-
-
-	/*** Scale down into DAC_RANGE! ***/	
-	peak = 256;
-	for (i=0; i<BUFSIZE; i++)									
-	{
-		Q_buf[b][i] /= peak;		
-		I_buf[b][i] /= peak;
+		k = BIN_FC*(BUFSIZE+i);
+		xi = AGC_MUL(XI_buf[BUFSIZE+i], mant, rs) + ((c*tab_sin(k+FFT_SIZE/4)) >> 15);
+		xq = AGC_MUL(XQ_buf[BUFSIZE+i], mant, rs) + ((c*tab_sin(k)) >> 15);
+		iqp[i] = DAC_IQ(X_OUT(xi), X_OUT(xq));
 	}
+	nco_dac(iqp, BUFSIZE);													// Fine tuning
+	PROF_STOP(PROF_OUT);
 
 	return true;
 }
-
-
-
-
-
@@ -6,9 +6,13 @@
  * Author: Arjan te Marvelde
  * 
  * Signal processing of RX and TX branch, to be run on the second processor core.
- * Each branch has a dedicated routine that must run on set times.
- * The period is determined by reads from the inter-core fifo, by the dsp_loop() routine. 
- * This fifo is written from core0 from a 16us timer callback routine (i.e. 62.5kHz)
+ * Each branch has a dedicated routine that processes one block of BUFSIZE audio samples.
+ * At the higher I/Q rates a block holds 2x or 4x as many I/Q and A samples, these are low pass 
+ * filtered and decimated to S_RATE before (de)modulation, the I/Q output samples are repeated.
+ * The period is determined by the ADC block handler in dsp.c, which fills the I, Q and A queues
+ * and triggers the dsp_loop() routine when a block is complete.
+ * The block is processed per sample, and the results are written to the DAC output block 
+ * that is not being played, the DACs are fed by DMA.
  *
  * The RX branch:
  * - Sample I and Q QSD channels, and shift into I and Q delay line (62.5 kHz per channel)
@@ -31,6 +35,15 @@
 #include "uSDR.h"
 
 
+/*
+ * Sample queues, filled per ADC block by the block handler in dsp.c
+ * 3x buffer of IQSIZE: one is being filled, the newest complete one is processed.
+ */
+int16_t I_buf[3][IQSIZE] __attribute__((aligned(4)));						// I sample queue
+int16_t Q_buf[3][IQSIZE] __attribute__((aligned(4)));						// Q sample queue
+int16_t A_buf[3][IQSIZE] __attribute__((aligned(4)));						// A sample queue
+#define A_IDX(t)		(t)													// A buffer index, in sequence
+
 volatile int32_t q_sample, i_sample, a_sample;								// Latest processed sample values
 
 
@@ -46,29 +59,23 @@ int16_t lpf7_62[15] =  { -2, -1,  1,  7, 16, 26, 33, 36, 33, 26, 16,  7,  1, -1,
 int16_t lpf7_31[15] =  { -1,  4,  9,  2,-12, -2, 40, 66, 40, -2,-12,  2,  9,  4, -1};	// Pass: 0-7000, Stop: 10000-15625
 int16_t lpf15_62[15] = { -1,  3, 12,  6,-12, -4, 40, 69, 40, -4,-12,  6, 12,  3, -1};	// Pass: 0-15000, Stop: 20000-31250
 
+// The 3kHz filter for each I/Q rate, ahead of decimation to S_RATE
+int16_t *lpf3[3] = {lpf3_15, lpf3_31, lpf3_62};
+
 
 
 
 /** CORE1: RX Branch **/
 
 /* 
- * Execute RX branch signal processing
- * max time to spend is <64us (TIM_US)
+ * Shift-in I and Q raw samples, at the I/Q rate
  * The pre-processed I/Q samples are passed in i_sample and q_sample
- * The calculated A sample is passed in a_sample
  */
 volatile int32_t i_s_raw[15], q_s_raw[15];									// Raw I/Q samples minus DC bias
-volatile int32_t i_s[15], q_s[15];											// Filtered I/Q samples
-bool __not_in_flash_func(rx)(void) 
+static void __not_in_flash_func(rx_shift)(void) 
 {
-	int32_t q_accu, i_accu;
-	int32_t qh;
 	uint16_t i;
 	
-	/*** SAMPLING ***/
-	/* 
-	 * Shift-in I and Q raw samples 
-	 */
 	for (i=0; i<14; i++)													// Store preprocessed samples in shift registers
 	{
 		q_s_raw[i] = q_s_raw[i+1];
@@ -76,17 +83,32 @@ bool __not_in_flash_func(rx)(void)
 	}
 	q_s_raw[14] = q_sample;
 	i_s_raw[14] = i_sample;
-	
+}
+
+/* 
+ * Execute RX branch signal processing for one sample, at S_RATE
+ * The raw I/Q samples are in the shift registers, see rx_shift()
+ * The calculated A sample is passed in a_sample
+ */
+volatile int32_t i_s[15], q_s[15];											// Filtered I/Q samples
+static bool __not_in_flash_func(rx_sample)(void) 
+{
+	int32_t q_accu, i_accu;
+	int32_t qh;
+	int16_t *lpf;
+	uint16_t i;
 	
 	/*
-	 * Low pass FIR filter
+	 * Low pass FIR filter, only evaluated for the decimated samples
 	 */
+	PROF_START(PROF_FIR);
+	lpf = lpf3[dsp_rate];
 	q_accu = 0;																// Initialize accumulators
 	i_accu = 0;
 	for (i=0; i<15; i++)													// Low pass FIR filter
 	{
-		q_accu += (int32_t)q_s_raw[i]*lpf3_15[i];							// Fc=3kHz, at 15625 Hz sampling		
-		i_accu += (int32_t)i_s_raw[i]*lpf3_15[i];							// Fc=3kHz, at 15625 Hz sampling	
+		q_accu += (int32_t)q_s_raw[i]*lpf[i];								// Fc=3kHz, at the I/Q rate
+		i_accu += (int32_t)i_s_raw[i]*lpf[i];
 	}
 	q_accu = q_accu/256;
 	i_accu = i_accu/256;
@@ -98,9 +120,11 @@ bool __not_in_flash_func(rx)(void)
 	}
 	q_s[14] = q_accu;
 	i_s[14] = i_accu;
+	PROF_STOP(PROF_FIR);
 	
 
 	/*** DEMODULATION ***/
+	PROF_START(PROF_DEMOD);
 	switch (dsp_mode)
 	{
 	case MODE_USB:
@@ -109,9 +133,11 @@ bool __not_in_flash_func(rx)(void)
 		 * Qh is Classic Hilbert transform 15 taps, 12 bits 
 		 * (see Iowa Hills calculator)
 		 */	
+		PROF_START(PROF_HILB);
 		q_accu = (q_s[0]-q_s[14])*315L + (q_s[2]-q_s[12])*440L + 
 		         (q_s[4]-q_s[10])*734L + (q_s[6]-q_s[ 8])*2202L;
 		qh = q_accu / 4096L;	
+		PROF_STOP(PROF_HILB);
 		a_sample = i_s[7] - qh;
 		break;
 	case MODE_LSB:
@@ -120,9 +146,11 @@ bool __not_in_flash_func(rx)(void)
 		 * Qh is Classic Hilbert transform 15 taps, 12 bits 
 		 * (see Iowa Hills calculator)
 		 */	
+		PROF_START(PROF_HILB);
 		q_accu = (q_s[0]-q_s[14])*315L + (q_s[2]-q_s[12])*440L + 
 		         (q_s[4]-q_s[10])*734L + (q_s[6]-q_s[ 8])*2202L;
 		qh = q_accu / 4096L;	
+		PROF_STOP(PROF_HILB);
 		a_sample = i_s[7] + qh;
 		break;
 	case MODE_AM:
@@ -135,18 +163,10 @@ bool __not_in_flash_func(rx)(void)
 	default:
 		break;
 	}
+	PROF_STOP(PROF_DEMOD);
 	
 	/*** AUDIO GENERATION ***/
-
-	/*
-	 * Scale and clip output,  
-	 * Send to audio DAC output
-	 */
-	a_sample = (a_sample/64) + DAC_BIAS;									// -18dB and add bias level
-	if (a_sample > DAC_RANGE)												// Clip to DAC range
-		a_sample = DAC_RANGE;
-	else if (a_sample<0)
-		a_sample = 0;
+	// Scaling, bias and clipping are done per block, after AGC
 
 	return true;
 }
@@ -154,35 +174,46 @@ bool __not_in_flash_func(rx)(void)
 
 /** CORE1: TX branch **/
 /*
- * Execute TX branch signal processing, 
- * max time to spend is <64us (TIM_US)
+ * Shift-in the raw audio sample, at the I/Q rate
  * The pre-processed audio sample is passed in a_sample
- * The calculated I and Q samples are passed in i_sample and q_sample
  */
 volatile int16_t a_s_raw[15]; 												// Raw samples, minus DC bias
-volatile int16_t a_s[15];													// Filtered and decimated samplesvolatile int16_t 
-bool __not_in_flash_func(tx)(void) 
+static void __not_in_flash_func(tx_shift)(void) 
 {
-	int32_t a_accu, q_accu;
-	int16_t qh;
 	int i;
-	uint16_t i_dac, q_dac;
-		
-	/*** RAW Audio ***/
+	
 	for (i=0; i<14; i++) 													//   and store in shift register
 		a_s_raw[i] = a_s_raw[i+1];
 	a_s_raw[14] = a_sample;
-	
+}
+
+/*
+ * Execute TX branch signal processing for one sample, at S_RATE
+ * The raw audio samples are in the shift register, see tx_shift()
+ * The calculated I and Q samples are passed in i_sample and q_sample
+ */
+volatile int16_t a_s[15];													// Filtered and decimated samples
+static bool __not_in_flash_func(tx_sample)(void) 
+{
+	int32_t a_accu, q_accu;
+	int16_t qh, *lpf;
+	int i;
+	uint16_t i_dac, q_dac;
+		
 	/*** Low pass filter ***/
+	PROF_START(PROF_FIR);
+	lpf = lpf3[dsp_rate];
 	a_accu = 0;																// Initialize accumulator
 	for (i=0; i<15; i++)													// Low pass FIR filter, using raw samples
-		a_accu += (int32_t)a_s_raw[i]*lpf3_15[i];							//   Fc=3kHz, at 15.625 kHz sampling		
+		a_accu += (int32_t)a_s_raw[i]*lpf[i];								//   Fc=3kHz, at the I/Q rate
 		
 	for (i=0; i<14; i++) 													// Shift decimated samples
 		a_s[i] = a_s[i+1];
 	a_s[14] = a_accu / 256;													// Store rescaled accumulator
+	PROF_STOP(PROF_FIR);
 
 	/*** MODULATION ***/
+	PROF_START(PROF_DEMOD);
 	switch (dsp_mode)
 	{
 	case 0:																	// USB
@@ -190,18 +221,22 @@ bool __not_in_flash_func(tx)(void)
 		 * qh is Classic Hilbert transform 15 taps, 12 bits 
 		 * (see Iowa Hills calculator)
 		 */	
+		PROF_START(PROF_HILB);
 		q_accu = (a_s[0]-a_s[14])*315L + (a_s[2]-a_s[12])*440L + 
 		         (a_s[4]-a_s[10])*734L + (a_s[6]-a_s[ 8])*2202L;
 		qh = -(q_accu / 4096L);												// USB: sign is negative
+		PROF_STOP(PROF_HILB);
 		break;
 	case 1:																	// LSB
 		/* 
 		 * qh is Classic Hilbert transform 15 taps, 12 bits 
 		 * (see Iowa Hills calculator)
 		 */	
+		PROF_START(PROF_HILB);
 		q_accu = (a_s[0]-a_s[14])*315L + (a_s[2]-a_s[12])*440L + 
 		         (a_s[4]-a_s[10])*734L + (a_s[6]-a_s[ 8])*2202L;
 		qh = q_accu / 4096L;												// LSB: sign is positive
+		PROF_STOP(PROF_HILB);
 		break;
 	case 2:																	// AM
 		/*
@@ -233,10 +268,84 @@ bool __not_in_flash_func(tx)(void)
 		i_sample = DAC_RANGE-1;
 	else
 		i_sample = a_accu;
-		
+	PROF_STOP(PROF_DEMOD);
 	
 	return true;
 }
 
 
+/** CORE1: Block processing **/
+/*
+ * Execute RX or TX branch signal processing for the newest block
+ * max time to spend is <4ms (BUFSIZE*TIM_US)
+ * Samples are taken from the queue buffer that was completed last,
+ * the results go into the DAC output block that is not being played.
+ * Per audio sample there are 1<<dsp_rate I/Q samples.
+ * RX keeps the demodulated block, so the AGC can look ahead before output.
+ */
+int32_t a_blk[BUFSIZE];														// Demodulated block, before AGC
+bool __not_in_flash_func(rx)(void) 
+{
+	int b, i, j, k, n, rs;
+	int32_t mant, g;
+	uint32_t peak;
+	uint64_t pw;
+	uint16_t *ap;
+	
+	b = dsp_active + 2;														// Point to newest saved buffer
+	if (b > 2) b -= 3;
+	nco_iq(I_buf[b], Q_buf[b], dsp_iqblk);									// Fine tuning
+	k = 1<<dsp_rate;
+	peak = 0; pw = 0;
+	for (i=0, n=0; i<BUFSIZE; i++)
+	{
+		for (j=0; j<k; j++, n++)
+		{
+			i_sample = I_buf[b][n];
+			q_sample = Q_buf[b][n];
+			rx_shift();
+		}
+		rx_sample();
+		a_blk[i] = a_sample;
+		if (ABS(a_sample) > peak) peak = ABS(a_sample);
+		pw += (uint32_t)(i_s[14]*i_s[14]) + (uint32_t)(q_s[14]*q_s[14]);
+	}
+	
+	// S-meter, from the low pass filtered I/Q power, corrected for the DC gain of the filter
+	// The filter passes both sidebands, and there is no noise estimate
+	for (i=0, g=0; i<15; i++) g += lpf3[dsp_rate][i];
+	smtr_update(log2_q16_64(pw) - log2_q16(BUFSIZE) - 2*(log2_q16(g) - (8<<16)), SMTR_NONE);
+	
+	PROF_START(PROF_OUT);
+	exp2_q16(dsp_agc(peak, 0), &mant, &rs);
+	ap = dac_abuf[dac_play^1];
+	for (i=0; i<BUFSIZE; i++)
+		ap[i] = DAC_CLIP(AGC_MUL(a_blk[i], mant, rs) + DAC_BIAS);
+	PROF_STOP(PROF_OUT);
+	return true;
+}
+
+bool __not_in_flash_func(tx)(void) 
+{
+	int b, i, j, k, n;
+	uint32_t *iqp;
+	
+	b = dsp_active + 2;														// Point to newest saved buffer
+	if (b > 2) b -= 3;
+	k = 1<<dsp_rate;
+	iqp = dac_iqbuf[dac_play^1];
+	for (i=0, n=0; i<BUFSIZE; i++)
+	{
+		for (j=0; j<k; j++)
+		{
+			a_sample = A_buf[b][A_IDX(n+j)];
+			tx_shift();
+		}
+		tx_sample();
+		for (j=0; j<k; j++, n++)											// Hold the output for the I/Q rate
+			iqp[n] = DAC_IQ(i_sample, q_sample);
+	}
+	nco_dac(iqp, dsp_iqblk);												// Fine tuning
+	return true;
+}
 
@@ -9,9 +9,73 @@
  * See fix_fft.c for more information 
  */
 
-#define FFT_SIZE	1024				// Use this for buffer allocations
-#define FFT_ORDER	10					// FFT_SIZE = 1 << FFT_ORDER
+/*
+ * FFT_ORDER can be set when configuring the build, e.g. cmake -DFFT_ORDER=8 ..
+ * Range is 7..12, i.e. 128..4096 points. Default is 1024 points.
+ */
+#ifndef FFT_ORDER
+#define FFT_ORDER	10					
+#endif
+#if (FFT_ORDER < 7) || (FFT_ORDER > 12)
+#error "FFT_ORDER must be in range 7..12"
+#endif
+#define FFT_SIZE	(1<<FFT_ORDER)		// Use this for buffer allocations
+
+/*
+ * FFT_STOCKHAM selects the Stockham autosort kernel, cmake -DFFT_STOCKHAM=ON ..
+ * It needs no bitrev table, but a second buffer pair, see fix_fft_work().
+ */
+#ifndef FFT_STOCKHAM
+#define FFT_STOCKHAM	0
+#endif
+
+/*
+ * Twiddle and bit reverse tables, generated compile-time in fix_fft_tab.cpp
+ */
+typedef struct
+{
+	int16_t sine[3*FFT_SIZE/4];			// Fixed point Sine lookup table, [-1, 1] == [-32768, 32767]
+#if FFT_STOCKHAM == 0
+	int16_t bitrev[FFT_SIZE];			// Bit reversed index
+#endif
+} fft_tab_t;
+extern fft_tab_t fft_tab;
+
+/*
+ * Input frame, as two halves that need not be consecutive
+ * The halves are the first and second part of the Re and Im input, e.g. overlapping sample blocks.
+ */
+typedef struct
+{
+	int16_t *re[2];
+	int16_t *im[2];
+} fft_frame_t;
+
+/*
+ * Output pruning of the forward FFT, see fix_fft_prune()
+ * Bit s+m is set when butterfly column m of the stage with quarter span s is needed.
+ * Set the wanted bins with fix_fft_padd(), FFT_PBIN() tells which bins are computed.
+ */
+typedef struct
+{
+	uint32_t map[FFT_SIZE/64];			// Bits 1..FFT_SIZE/2-1
+} fft_prune_t;
+#if FFT_STOCKHAM == 1
+#define FFT_PBIN(p, k)	true			// Not pruned
+#else
+#define FFT_PBIN(p, k)	(((p)->map[(FFT_SIZE/4 + ((k)&(FFT_SIZE/4-1)))>>5] >> ((k)&31)) & 1)
+#endif
 
 int fix_fft(int16_t *fr, int16_t *fi, bool inverse);
+int fix_fft_n(int16_t *fr, int16_t *fi, int order, bool inverse);
+int fix_fft_frame(int16_t *fr, int16_t *fi, const fft_frame_t *in);
+int fix_fft_real(int16_t *fr, int16_t *fi, const fft_frame_t *in);
+void fix_fft_pclear(fft_prune_t *p);
+void fix_fft_padd(fft_prune_t *p, int lo, int hi);
+int fix_fft_prune(int16_t *fr, int16_t *fi, const fft_frame_t *in, const fft_prune_t *p);
+int fix_fft_pskip(const fft_prune_t *p);
+#if FFT_STOCKHAM == 1
+void fix_fft_work(int16_t *wr0, int16_t *wr1, int16_t *wi0, int16_t *wi1);
+#endif
 
 #endif
@@ -0,0 +1,93 @@
+/* 
+ * fix_fft_tab.cpp
+ *
+ * Created: Oct 2026
+ *
+ * Lookup tables for fix_fft.c, generated compile-time for the FFT_ORDER set in fix_fft.h.
+ * The generator is constexpr C++, so no external tools are needed and the tables always 
+ * match FFT_SIZE. The table object is not const, so it is placed in RAM like before.
+ *
+ * Sine[i]   = (int)(32767*sin(2*pi*i/FFT_SIZE)), i < 3*FFT_SIZE/4
+ * bitrev[i] = i with its FFT_ORDER bits reversed, not needed for FFT_STOCKHAM
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+extern "C" {
+#include "fix_fft.h"
+}
+
+
+/*
+ * sin(x) for 0 <= x < 2*pi, std::sin() is not constexpr
+ * The argument is reduced to [0, pi/4] by symmetry, then a Taylor series is used,
+ * which is accurate to about 1e-16 in that range.
+ */
+static constexpr double PI = 3.14159265358979323846;
+
+static constexpr double taylor_sin(double x)
+{
+	double term = x, sum = x;
+	for (int n=1; n<12; n++)
+	{
+		term = -term*x*x/((2*n)*(2*n+1));
+		sum += term;
+	}
+	return sum;
+}
+
+static constexpr double taylor_cos(double x)
+{
+	double term = 1.0, sum = 1.0;
+	for (int n=1; n<12; n++)
+	{
+		term = -term*x*x/((2*n-1)*(2*n));
+		sum += term;
+	}
+	return sum;
+}
+
+static constexpr double cx_sin(double x)
+{
+	double sign = 1.0;
+	if (x >= PI) { x -= PI; sign = -1.0; }									// sin(x+pi) = -sin(x)
+	if (x > PI/2) x = PI - x;												// sin(pi-x) = sin(x)
+	if (x > PI/4) return sign*taylor_cos(PI/2 - x);							// sin(x) = cos(pi/2-x)
+	return sign*taylor_sin(x);
+}
+
+
+/*
+ * Generate both tables
+ */
+static constexpr fft_tab_t fft_gen(void)
+{
+	fft_tab_t t {};
+	
+	for (int i=0; i<3*FFT_SIZE/4; i++)
+		t.sine[i] = (int16_t)(32767.0*cx_sin(2.0*PI*i/FFT_SIZE));			// Truncated, as the original table
+
+#if FFT_STOCKHAM == 0
+	for (int i=0; i<FFT_SIZE; i++)
+	{
+		int r = 0;
+		for (int b=0; b<FFT_ORDER; b++)
+			if (i & (1<<b)) r |= 1<<(FFT_ORDER-1-b);
+		t.bitrev[i] = (int16_t)r;
+	}
+#endif
+	
+	return t;
+}
+
+static_assert(fft_gen().sine[FFT_SIZE/4] == 32767, "Sine table peak");
+#if FFT_STOCKHAM == 0
+static_assert(fft_gen().bitrev[1] == FFT_SIZE/2, "Bit reverse table");
+#endif
+
+
+/*
+ * The table object, constant initialized from the generator
+ */
+fft_tab_t fft_tab = fft_gen();										// C linkage from fix_fft.h
@@ -25,6 +25,11 @@
  * 
  * The PTT is connected to GP15 and will be active, except when VOX is used.
  *
+ * Tuning is split between the Si5351 LO and the NCO in the DSP, see dsp_setnco().
+ * The LO stays at hmi_lo while both the RX and the TX frequency, including RIT and XIT, are within 
+ * NCO_WIN of it, so most tuning steps are click-free and need no I2C traffic. When either leaves 
+ * the window, the LO is moved to the middle of both. So the LO never moves at the T/R switch, and 
+ * TX starts on its frequency: RIT and XIT may only be 2*NCO_WIN apart, see hmi_setrit().
  */
 #include <stdio.h>
 #include <string.h>
@@ -126,6 +131,9 @@ uint32_t hmi_step[6] = {10000000, 1000000, 100000, 10000, 1000, 100};		// Freque
 #define HMI_MINFREQ		     100
 #define HMI_MULFREQ            1											// Factor between HMI and actual frequency
 																			// Set to 2 for certain types of mixer
+uint32_t hmi_lo;															// Frequency of the LO, plus FC_OFFSET
+int hmi_rit = 0, hmi_xit = 0;												// RX and TX offsets from hmi_freq, Hz
+#define HMI_MAXRIT		5000
 
 #define PTT_DEBOUNCE	3													// Nr of cycles for debounce
 int ptt_state;																// Debounce counter
@@ -140,6 +148,9 @@ bool ptt_active;															// Resulting state
 #ifndef MAX
 #define MAX(x, y)        ((x)>(y)?(x):(y))  // Get max value
 #endif
+#ifndef ABS
+#define ABS(x)           ((x)<0?-(x):(x))   // Get absolute value
+#endif
 
 
 /*
@@ -245,7 +256,8 @@ void hmi_callback(uint gpio, uint32_t events)
  */
 void hmi_evaluate(void)
 {
-	int band;
+	int band, w;
+	uint32_t frx, ftx;
 	char s[32];
 	
 	// Print top line of display
@@ -311,8 +323,16 @@ void hmi_evaluate(void)
 
 	/* Set parameters corresponding to latest entered option value */
 	
-	// See if VFO needs update
-	si_evaluate(0, HMI_MULFREQ*(hmi_freq-FC_OFFSET));
+	// See if VFO needs update, or only the NCO offsets
+	w = NCO_WIN(dsp_getrate());
+	if (ABS(hmi_xit - hmi_rit) > 2*w)										// The window shrank with the rate
+		hmi_xit = (hmi_xit > hmi_rit) ? hmi_rit + 2*w : hmi_rit - 2*w;
+	frx = hmi_freq + hmi_rit;
+	ftx = hmi_freq + hmi_xit;
+	if ((ABS((int32_t)(frx - hmi_lo)) > w) || (ABS((int32_t)(ftx - hmi_lo)) > w))
+		hmi_lo = (frx + ftx)/2;												// Move the LO between RX and TX
+	si_evaluate(0, HMI_MULFREQ*(hmi_lo-FC_OFFSET));
+	dsp_setnco(frx - hmi_lo, ftx - hmi_lo);
 	
 	// Check bandfilter setting (thanks Alex)
 	if      (hmi_freq < 2500000UL)	band = REL_LPF2;
@@ -335,11 +355,28 @@ void hmi_evaluate(void)
 		dsp_setagc(hmi_sub[HMI_S_AGC]);	
 		relay_setband(hmi_bpf[hmi_sub[HMI_S_BPF]]);
 		relay_setattn(hmi_pre[hmi_sub[HMI_S_PRE]]);
+		dsp_setcal(hmi_bpf[hmi_sub[HMI_S_BPF]], hmi_pre[hmi_sub[HMI_S_PRE]]);
 		hmi_update = false;
 	}
 }
 
 
+/*
+ * RIT and XIT, offsets in Hz of the RX and TX frequency from the tuned frequency
+ * Applied on the next hmi_evaluate()
+ * One LO serves both, so a split of more than 2*NCO_WIN is refused and false is returned.
+ */
+bool hmi_setrit(int rit, int xit)
+{
+	rit = MIN(HMI_MAXRIT, MAX(-HMI_MAXRIT, rit));
+	xit = MIN(HMI_MAXRIT, MAX(-HMI_MAXRIT, xit));
+	if (ABS(xit - rit) > 2*NCO_WIN(dsp_getrate())) return false;
+	hmi_rit = rit;
+	hmi_xit = xit;
+	return true;
+}
+
+
 /*
  * Initialize the User interface
  */
@@ -381,9 +418,11 @@ void hmi_init(void)
 	hmi_state = HMI_S_TUNE;
 	hmi_option = 4;															// Active kHz digit
 	hmi_freq = 7074000UL;													// Initial frequency
+	hmi_lo = hmi_freq;
 
 	si_setphase(0, 1);														// Set phase to 90deg (depends on mixer type)
-	si_evaluate(0, HMI_MULFREQ*(hmi_freq-FC_OFFSET));						// Set freq to 7074 kHz (depends on mixer type)
+	si_evaluate(0, HMI_MULFREQ*(hmi_lo-FC_OFFSET));							// Set freq to 7074 kHz (depends on mixer type)
+	dsp_setnco(0, 0);
 	
 	ptt_state  = PTT_DEBOUNCE;
 	ptt_active = false;
@@ -393,6 +432,7 @@ void hmi_init(void)
 	dsp_setagc(hmi_sub[HMI_S_AGC]);	
 	relay_setattn(hmi_pre[hmi_sub[HMI_S_PRE]]);
 	relay_setband(hmi_bpf[hmi_sub[HMI_S_BPF]]);
+	dsp_setcal(hmi_bpf[hmi_sub[HMI_S_BPF]], hmi_pre[hmi_sub[HMI_S_PRE]]);
 	hmi_update = false;
 }
 
@@ -10,8 +10,10 @@
  */
 
 extern bool ptt_active;
+extern int hmi_rit, hmi_xit;
 
 void hmi_init(void);
 void hmi_evaluate(void);
+bool hmi_setrit(int rit, int xit);			// RIT and XIT offsets in Hz, false when too far apart
 
 #endif
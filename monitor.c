@@ -20,7 +20,10 @@
 #include "lcd.h"
 #include "si5351.h"
 #include "dsp.h"
+#include "hmi.h"
 #include "relay.h"
+#include "fix_fft.h"
+#include "prof.h"
 #include "monitor.h"
 
 
@@ -200,40 +203,220 @@ void mon_rx(void)
  * Checks for overruns 
  */
 extern volatile uint32_t dsp_overrun;
-#if DSP_FFT == 1
 extern volatile uint32_t dsp_tickx;
+extern volatile int dsp_iqblk;
+extern volatile int dsp_shed;
+extern volatile uint32_t dsp_load;
+#if DSP_FFT == 1
 extern volatile int scale0;
 extern volatile int scale1;
 #endif
 void mon_or(void)
 {
 	printf("DSP overruns   : %d\n", dsp_overrun);
+	printf("DSP loop load  : %lu%%\n", (100*dsp_tickx)/dsp_iqblk);	
+	printf("DSP block time : %lu%%, shed level %d\n", (100*dsp_load)>>8, dsp_shed);	
 #if DSP_FFT == 1
-	printf("DSP loop load  : %lu%%\n", (100*dsp_tickx)/512);	
 	printf("FFT scale = %d, iFFT scale = %d\n", scale0, scale1);	
 #endif
 }
 
 
 /* 
- * ADC and AGC levels 
+ * S-meter, ADC and AGC levels 
  */
-extern volatile int32_t  rx_agc;
+extern volatile int32_t  agc_gain;
 extern volatile int adccnt;
 void mon_adc(void)
 {
 	// Print results
-	printf("RSSI: %5u\n", s_rssi);
-	printf("AGC : %5d\n", rx_agc);
-	printf("ADCc: %5d\n", adccnt);
+	printf("Peak: %5d dBm\n", dsp_getlevel(SMTR_PEAK)/10);
+	printf("Avg : %5d dBm\n", dsp_getlevel(SMTR_AVG)/10);
+	printf("NF  : %5d dBm\n", dsp_getlevel(SMTR_FLOOR)/10);
+	printf("AGC : %5d dB\n", (agc_gain*602)/(100<<16));
+	printf("ADCb: %5d\n", adccnt);
+}
+
+
+/* 
+ * I/Q sample rate, 0..2 for 15625, 31250 and 62500 Hz
+ */
+void mon_rate(void)
+{
+	if (nargs>1)
+	{
+		dsp_setrate(atoi(argv[1]));
+		sleep_ms(100);												// Applied between two blocks
+	}
+	printf("I/Q rate: %d Hz\n", S_RATE<<dsp_getrate());
+}
+
+/* 
+ * I/Q balance: adapt, freeze or off, and the correction coefficients
+ * a is the Q gain correction, b the I into Q crosstalk, ~ phase correction in rad
+ */
+extern volatile int32_t iq_a, iq_b;
+extern int dsp_iq;
+void mon_iq(void)
+{
+	const char *mode[3] = {"off", "adapt", "freeze"};
+	
+	if (nargs>1)
+	{
+		switch (*argv[1])
+		{
+		case 'o': dsp_setiq(IQ_OFF); break;
+		case 'a': dsp_setiq(IQ_ADAPT); break;
+		case 'f': dsp_setiq(IQ_FREEZE); break;
+		}
+		sleep_ms(100);												// Applied between two blocks
+	}
+	printf("I/Q balance %s: gain %ld permille, phase %ld mrad\n", mode[dsp_iq], 
+			(iq_a*1000)/32768, (iq_b*1000)/32768);
+}
+
+/* 
+ * Noise reduction strength, 0..3 for off, low, medium and high
+ */
+extern int dsp_nr;
+void mon_nr(void)
+{
+	if (nargs>1)
+	{
+		dsp_setnr(atoi(argv[1]));
+		sleep_ms(100);												// Applied between two blocks
+	}
+	printf("Noise reduction: %d\n", dsp_nr);
 }
 
+/* 
+ * RIT and XIT offsets in Hz, taken by the NCO while they stay within its window
+ * They share the LO, so they can be at most twice the window apart.
+ */
+void mon_rit(void)
+{
+	if ((nargs>1) && !hmi_setrit(atoi(argv[1]), hmi_xit))
+		printf("RIT and XIT more than %d Hz apart\n", 2*NCO_WIN(dsp_getrate()));
+	printf("RIT: %d Hz\n", hmi_rit);
+}
+
+void mon_xit(void)
+{
+	if ((nargs>1) && !hmi_setrit(hmi_rit, atoi(argv[1])))
+		printf("RIT and XIT more than %d Hz apart\n", 2*NCO_WIN(dsp_getrate()));
+	printf("XIT: %d Hz\n", hmi_xit);
+}
+
+#if DSP_FFT == 1
+/* 
+ * Auto-notch on (1) or off (0), and the notched audio frequencies
+ */
+extern int dsp_notch;
+extern volatile int nt_bin[];
+void mon_notch(void)
+{
+	int j, k;
+	
+	if (nargs>1)
+	{
+		dsp_setnotch(atoi(argv[1]));
+		sleep_ms(100);												// Applied between two blocks
+	}
+	printf("Auto-notch: %s", dsp_notch?"on":"off");
+	for (j=0; j<NOTCH_MAX; j++)
+	{
+		k = nt_bin[j];
+		if (k > 0) printf(", %d Hz", (k*(S_RATE<<dsp_getrate()) + FFT_SIZE/2)/FFT_SIZE);
+	}
+	printf("\n");
+}
+
+/* 
+ * Bandpass flank length in FFT bins, FLANK_MIN..FLANK_MAX
+ */
+extern int dsp_flank;
+void mon_flank(void)
+{
+	if (nargs>1)
+	{
+		dsp_setflank(atoi(argv[1]));
+		sleep_ms(100);												// Applied between two blocks
+	}
+	printf("Flank: %d bins\n", dsp_flank);
+}
+
+/* 
+ * Extra receiver channels: mode and offset in Hz of channel c, and the channel levels
+ */
+extern int dsp_chan[], dsp_choff[];
+void mon_ch(void)
+{
+	const char *mode[5] = {"off", "usb", "lsb", "am", "cw"};
+	int c, m;
+	
+	if (nargs>2)
+	{
+		c = atoi(argv[1]);
+		for (m=0; m<5; m++)
+			if (*argv[2] == *mode[m]) break;								// First letter is unique
+		if (m < 5)
+			dsp_setchan(c, m-1, (nargs>3) ? atoi(argv[3]) : 0);
+		sleep_ms(100);												// Applied between two blocks
+	}
+	for (c=0; c<CHAN_MAX; c++)
+	{
+		printf("Channel %d: %s", c, mode[dsp_chan[c]+1]);
+		if (dsp_chan[c] != CHAN_OFF) printf(" %+d Hz, %d dBm", dsp_choff[c], dsp_getchan(c)/10);
+		printf("\n");
+	}
+}
+#endif
+
+/* 
+ * Spectrum frame: the newest one, as SPEC_NBIN values in dBFS + SPEC_DB0
+ * After an idle period the ring only holds stale frames, then it waits for the next block.
+ */
+extern volatile uint32_t spec_drop;
+void mon_spec(void)
+{
+	spec_frame_t f;
+	int i;
+	
+	for (i=0; (i<10) && !dsp_getspec(&f); i++)
+		sleep_ms(20);
+	if (i == 10)
+	{
+		printf("No spectrum frame\n");
+		return;
+	}
+	printf("Frame %lu, span %d Hz, dropped %lu, dBFS+%d:", f.seq, S_RATE<<f.rate, spec_drop, SPEC_DB0);
+	for (i=0; i<SPEC_NBIN; i++)
+		printf("%s%3d", (i%16)?" ":"\n", f.db[i]);
+	printf("\n");
+}
+
+#if DSP_PROF == 1
+/* 
+ * DSP stage profile, see prof.c
+ */
+void mon_prof(void)
+{
+	if ((nargs>1) && (*argv[1]=='r'))
+	{
+		prof_reset();
+		printf("Reset\n");
+	}
+	else
+		prof_dump();
+}
+#endif
+
 
 
 /*
  * Command shell table, organize the command functions above
  */
-#define NCMD	9
+#define NCMD	(15 + DSP_PROF + 3*DSP_FFT)
 shell_t shell[NCMD]=
 {
 	{"flash", 5, &mon_flash, "flash", "Reboots into USB bootloader mode"},
@@ -244,7 +427,21 @@ shell_t shell[NCMD]=
 	{"pt",  2, &mon_pt,  "pt (no parameters)", "Toggles PTT status"},
 	{"bp",  2, &mon_bp,  "bp {r|w} <value>", "Read or Write BPF relays"},
 	{"rx",  2, &mon_rx,  "rx {r|w} <value>", "Read or Write RX relays"},
-	{"adc", 3, &mon_adc, "adc (no parameters)", "Dump latest ADC readouts"}
+	{"adc", 3, &mon_adc, "adc (no parameters)", "Dump S-meter, AGC and ADC readouts"},
+	{"rate", 4, &mon_rate, "rate <0|1|2>", "Set or show the I/Q sample rate"},
+	{"iq", 2, &mon_iq, "iq [a|f|o]", "Adapt, freeze or switch off I/Q balance"},
+	{"nr", 2, &mon_nr, "nr <0|1|2|3>", "Set or show the noise reduction strength"},
+	{"rit", 3, &mon_rit, "rit <Hz>", "Set or show the RX offset"},
+	{"xit", 3, &mon_xit, "xit <Hz>", "Set or show the TX offset"},
+#if DSP_FFT == 1
+	{"notch", 5, &mon_notch, "notch <0|1>", "Set auto-notch, show notched frequencies"},
+	{"flank", 5, &mon_flank, "flank <1..15>", "Set or show the bandpass flank length"},
+	{"ch", 2, &mon_ch, "ch <c> {off|usb|lsb|am|cw} <Hz>", "Set or show the extra receiver channels"},
+#endif
+	{"spec", 4, &mon_spec, "spec (no parameters)", "Dump the newest spectrum frame"},
+#if DSP_PROF == 1
+	{"prof", 4, &mon_prof, "prof [r]", "Dump or reset the DSP stage profile"}
+#endif
 };
 
 
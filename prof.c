@@ -0,0 +1,105 @@
+/*
+ * prof.c
+ *
+ * Created: Oct 2026
+ *
+ * Stage profiler for the DSP loop on CORE1, enabled with DSP_PROF (see prof.h).
+ * Each stage is enclosed in PROF_START() and PROF_STOP(), which read the SysTick of CORE1.
+ * This counts processor clock cycles, and reading it costs only a few cycles, so stages that
+ * run per sample (e.g. the time domain FIR) can be profiled as well: the cycles are accumulated
+ * over the block. Once per DSP loop, PROF_BLOCK() adds the block totals to the statistics,
+ * stages that did not run in that block are skipped.
+ * The block handler is an interrupt on the same core, so its cycles are also counted in the
+ * stage that it interrupts.
+ * The statistics are printed by the monitor, prof_dump() runs on CORE0. A reset is done by
+ * CORE1, on the next block.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/platform.h"
+#include "hardware/clocks.h"
+
+#include "prof.h"
+
+#if DSP_PROF == 1
+
+prof_t prof_tab[PROF_NSTAGE];
+volatile bool prof_clear = true;											// Reset request
+
+const char *prof_name[PROF_NSTAGE] = {"copy", "fft", "shift", "ifft", "out", "fir", "hilb", "demod", "loop", "nr", "notch", "chan"};
+
+
+/*
+ * Start the SysTick of the calling core, free running from 2^24-1 on the processor clock
+ */
+void prof_init(void)
+{
+	systick_hw->csr = 0;
+	systick_hw->rvr = 0x00ffffff;
+	systick_hw->cvr = 0;													// Any write clears the counter
+	systick_hw->csr = 0x5;													// Enable, processor clock, no interrupt
+}
+
+/*
+ * Add the block totals to the statistics, called once per DSP loop
+ */
+void __not_in_flash_func(prof_block)(void)
+{
+	int s, k;
+	uint32_t c;
+	prof_t *p;
+
+	for (s=0; s<PROF_NSTAGE; s++)
+	{
+		p = &prof_tab[s];
+		if (prof_clear)
+		{
+			p->n = 0; p->min = 0xffffffff; p->max = 0; p->sum = 0;
+			for (k=0; k<PROF_NBIN; k++) p->hist[k] = 0;
+		}
+		c = p->acc;
+		p->acc = 0;
+		if (c == 0) continue;												// Stage did not run
+		p->n++;
+		p->sum += c;
+		if (c < p->min) p->min = c;
+		if (c > p->max) p->max = c;
+		k = 31 - __builtin_clz(c) - PROF_HLO;								// Histogram bin, log2 of cycles
+		if (k < 0) k = 0;
+		if (k >= PROF_NBIN) k = PROF_NBIN-1;
+		p->hist[k]++;
+	}
+	prof_clear = false;
+}
+
+void prof_reset(void)
+{
+	prof_clear = true;
+}
+
+/*
+ * Print the statistics, times in usec, and the non-empty histogram bins as log2(cycles):count
+ */
+void prof_dump(void)
+{
+	int s, k;
+	uint32_t mhz;
+	prof_t *p;
+
+	mhz = clock_get_hz(clk_sys)/1000000;
+	printf("stage       n     min     avg     max (usec)\n");
+	for (s=0; s<PROF_NSTAGE; s++)
+	{
+		p = &prof_tab[s];
+		if (p->n == 0) continue;
+		printf("%-6s %6lu %7lu %7lu %7lu\n", prof_name[s], p->n,
+				p->min/mhz, (uint32_t)(p->sum/p->n)/mhz, p->max/mhz);
+		printf("      ");
+		for (k=0; k<PROF_NBIN; k++)
+			if (p->hist[k] > 0) printf(" %d:%lu", k+PROF_HLO, p->hist[k]);
+		printf("\n");
+	}
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __PROF_H__
+#define __PROF_H__
+/*
+ * prof.h
+ *
+ * Created: Oct 2026
+ *
+ * See prof.c for more information
+ */
+
+/*
+ * DSP_PROF enables the stage profiler, cmake -DDSP_PROF=ON ..
+ * When it is 0 all PROF_ macros are empty, and no code or RAM is used.
+ */
+#ifndef DSP_PROF
+#define DSP_PROF	0
+#endif
+
+/* Profiled stages */
+#define PROF_COPY	0					// Block handler: decimation and copy into the queues
+#define PROF_FFT	1					// Forward FFT
+#define PROF_SHIFT	2					// Sideband shift and spectral mask
+#define PROF_IFFT	3					// Inverse FFT
+#define PROF_OUT	4					// AGC and output scaling into the DAC block
+#define PROF_FIR	5					// Time domain: low pass FIR
+#define PROF_HILB	6					// Time domain: Hilbert transform
+#define PROF_DEMOD	7					// Time domain: (de)modulation, Hilbert included
+#define PROF_LOOP	8					// Complete DSP loop iteration
+#define PROF_NR		9					// Noise reduction
+#define PROF_NOTCH	10					// Auto-notch
+#define PROF_CHAN	11					// Channelizer
+#define PROF_NSTAGE	12
+
+#if DSP_PROF == 1
+
+#include "hardware/structs/systick.h"
+
+/*
+ * Per stage the cycles are accumulated over one DSP block, then added to the statistics.
+ * The histogram bin k counts the blocks that took 2^(k+PROF_HLO) cycles or more, up to the next bin.
+ */
+#define PROF_NBIN	16
+#define PROF_HLO	8
+typedef struct
+{
+	uint32_t t0;						// SysTick at PROF_START
+	uint32_t acc;						// Cycles in the current block
+	uint32_t n;							// Nr of blocks
+	uint32_t min, max;					// Cycles per block
+	uint64_t sum;
+	uint32_t hist[PROF_NBIN];
+} prof_t;
+extern prof_t prof_tab[PROF_NSTAGE];
+
+/* SysTick counts down from 2^24-1 at clk_sys, so a stage can take up to 134msec at 125MHz */
+#define PROF_START(s)	(prof_tab[s].t0 = systick_hw->cvr)
+#define PROF_STOP(s)	(prof_tab[s].acc += (prof_tab[s].t0 - systick_hw->cvr) & 0x00ffffff)
+#define PROF_BLOCK()	prof_block()
+#define PROF_INIT()		prof_init()
+
+void prof_init(void);
+void prof_block(void);
+void prof_reset(void);
+void prof_dump(void);
+
+#else
+
+#define PROF_START(s)
+#define PROF_STOP(s)
+#define PROF_BLOCK()
+#define PROF_INIT()
+
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * bench_fft.c
+ *
+ * Created: Oct 2026
+ *
+ * Host benchmark of the FFT kernels, built per kernel at the default FFT_ORDER, see CMakeLists.txt
+ *     cmake --build build-tests --target bench
+ * Prints the time per call of the transforms the DSP branches use. The pruned transform is timed
+ * per mode and rate with the bin set of the RX engine, see rx_pruneset() in dsp_fft.c, against the
+ * full transform: the butterflies it does, its time, and whether rx() uses it.
+ * The host figures only show the relative cost of the kernels; on target, build with DSP_PROF and
+ * read the FFT and IFFT stages with the monitor command prof.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test.h"
+#include "pico/stdlib.h"
+#include "uSDR.h"
+#include "dsp.h"
+#include "fix_fft.h"
+
+#define BENCH_NS	2000000LL				// Minimum run time per measurement, nsec
+#define BENCH_REP	51					// Measurements, the fastest counts
+
+/* From dsp.c */
+extern volatile int dsp_rate;
+extern int dsp_mode;
+extern fft_prune_t rx_prune;
+extern bool rx_pruned;
+bool rx(void);
+void rx_pruneset(void);
+
+static int16_t xr[FFT_SIZE], xi[FFT_SIZE];
+static int16_t in_r[FFT_SIZE], in_i[FFT_SIZE];
+static fft_frame_t frame;
+
+#if FFT_STOCKHAM == 1
+static int16_t work[4][FFT_SIZE/2];
+#endif
+
+static int64_t now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static void b_frame(void)	{ fix_fft_frame(xr, xi, &frame); }
+static void b_real(void)	{ fix_fft_real(xr, xi, &frame); }
+static void b_prune(void)	{ fix_fft_prune(xr, xi, &frame, &rx_prune); }
+static void b_inv(void)		{ memcpy(xr, in_r, sizeof(xr)); memcpy(xi, in_i, sizeof(xi)); fix_fft(xr, xi, true); }
+static void b_copy(void)	{ memcpy(xr, in_r, sizeof(xr)); memcpy(xi, in_i, sizeof(xi)); }
+
+/* Time per call in nsec, the call is repeated for at least BENCH_NS, the fastest of BENCH_REP */
+static double bench(void (*f)(void))
+{
+	int64_t t0, t;
+	long n, i;
+	int k;
+	double b;
+
+	for (n=16; ; n*=2)
+	{
+		t0 = now_ns();
+		for (i=0; i<n; i++) f();
+		t = now_ns() - t0;
+		if (t >= BENCH_NS) break;
+	}
+	b = (double)t/n;
+	for (k=1; k<BENCH_REP; k++)
+	{
+		t0 = now_ns();
+		for (i=0; i<n; i++) f();
+		t = now_ns() - t0;
+		if ((double)t/n < b) b = (double)t/n;
+	}
+	return b;
+}
+
+int main(void)
+{
+	const char *mode[4] = {"USB", "LSB", "AM", "CW"};
+	int k, m, r, nb;
+	double copy, full;
+
+	for (k=0; k<FFT_SIZE; k++) { in_r[k] = test_rand(8192); in_i[k] = test_rand(8192); }
+	frame.re[0] = in_r; frame.re[1] = in_r + FFT_SIZE/2;
+	frame.im[0] = in_i; frame.im[1] = in_i + FFT_SIZE/2;
+
+	printf("FFT_ORDER %d, %s kernel, usec per call\n", FFT_ORDER, FFT_STOCKHAM ? "Stockham" : "DIT");
+	copy = bench(b_copy);
+	for (r=0; r<=2; r++)
+		for (m=MODE_USB; m<=MODE_CW; m++)
+		{
+			dsp_rate = r; dsp_mode = m;
+			rx();															// Bins of the rate, and the work buffers
+#if FFT_STOCKHAM == 1
+			fix_fft_work(work[0], work[1], work[2], work[3]);
+#endif
+			rx_pruneset();
+			full = bench(b_frame);
+			if ((r == 0) && (m == MODE_USB))
+			{
+				printf("fix_fft_frame   %8.2f\n", full/1000);
+				printf("fix_fft_real    %8.2f\n", bench(b_real)/1000);
+				printf("fix_fft inverse %8.2f\n", (bench(b_inv) - copy)/1000);
+				printf("fix_fft_prune    rate mode  butterflies  time  used by rx()\n");
+			}
+			nb = (FFT_ORDER/2)*(FFT_SIZE/4);
+			printf("                 %-4d %-4s  %10.0f%%  %3.0f%%  %s\n", r, mode[m],
+				   100.0*(nb - fix_fft_pskip(&rx_prune))/nb, 100.0*bench(b_prune)/full, rx_pruned ? "yes" : "no");
+		}
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef __STUB_HARDWARE_ADC_H__
+#define __STUB_HARDWARE_ADC_H__
+#include "pico/stdlib.h"
+typedef struct { io_rw_32 cs, result, fcs, fifo, div; } adc_hw_t;
+extern adc_hw_t *adc_hw;
+void adc_init(void);
+void adc_gpio_init(uint gpio);
+void adc_set_round_robin(uint mask);
+void adc_select_input(uint input);
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift);
+void adc_set_clkdiv(float clkdiv);
+void adc_run(bool run);
+void adc_fifo_drain(void);
+#endif
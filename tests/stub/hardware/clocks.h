@@ -0,0 +1,6 @@
+#ifndef __STUB_HARDWARE_CLOCKS_H__
+#define __STUB_HARDWARE_CLOCKS_H__
+#include "pico/stdlib.h"
+enum clock_index { clk_gpout0, clk_ref, clk_sys };
+uint32_t clock_get_hz(enum clock_index clk);
+#endif
@@ -0,0 +1,20 @@
+#ifndef __STUB_HARDWARE_DMA_H__
+#define __STUB_HARDWARE_DMA_H__
+#include "pico/stdlib.h"
+typedef struct { struct { io_rw_32 read_addr, write_addr, transfer_count, ctrl_trig; io_rw_32 al1[12]; } ch[12]; io_rw_32 ints0, inte0, intr, timer[4], multi_channel_trigger; } dma_hw_t; extern dma_hw_t *dma_hw;
+enum dma_channel_transfer_size { DMA_SIZE_8=0, DMA_SIZE_16=1, DMA_SIZE_32=2 };
+typedef struct { uint32_t ctrl; } dma_channel_config;
+dma_channel_config dma_channel_get_default_config(uint);
+void channel_config_set_transfer_data_size(dma_channel_config*, enum dma_channel_transfer_size);
+void channel_config_set_read_increment(dma_channel_config*, bool); void channel_config_set_write_increment(dma_channel_config*, bool);
+void channel_config_set_dreq(dma_channel_config*, uint); void channel_config_set_chain_to(dma_channel_config*, uint);
+void channel_config_set_high_priority(dma_channel_config*, bool);
+void dma_channel_configure(uint, const dma_channel_config*, volatile void*, const volatile void*, uint, bool);
+void dma_channel_set_irq0_enabled(uint, bool); void dma_channel_set_write_addr(uint, volatile void*, bool);
+void dma_channel_set_read_addr(uint, const volatile void*, bool); void dma_channel_abort(uint); void dma_channel_start(uint);
+bool dma_channel_is_busy(uint); void dma_timer_set_fraction(uint, uint16_t, uint16_t); uint dma_get_timer_dreq(uint);
+void dma_channel_set_trans_count(uint, uint32_t, bool); void dma_start_channel_mask(uint32_t);
+#define DREQ_ADC 36
+void channel_config_set_ring(dma_channel_config*, bool, uint);
+dma_channel_config dma_get_channel_config(uint); void dma_channel_set_config(uint, const dma_channel_config*, bool);
+#endif
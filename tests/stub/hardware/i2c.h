@@ -0,0 +1,8 @@
+#ifndef __STUB_HARDWARE_I2C_H__
+#define __STUB_HARDWARE_I2C_H__
+#include "pico/stdlib.h"
+typedef struct i2c_inst i2c_inst_t;
+extern i2c_inst_t *i2c0, *i2c1;
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+#endif
@@ -0,0 +1,11 @@
+#ifndef __STUB_HARDWARE_IRQ_H__
+#define __STUB_HARDWARE_IRQ_H__
+#include "pico/stdlib.h"
+typedef void (*irq_handler_t)(void);
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+void irq_set_priority(uint num, uint8_t priority);
+#define DMA_IRQ_0	11
+#define DMA_IRQ_1	12
+#define PICO_LOWEST_IRQ_PRIORITY	0xff
+#endif
@@ -0,0 +1,12 @@
+#ifndef __STUB_HARDWARE_PWM_H__
+#define __STUB_HARDWARE_PWM_H__
+#include "pico/stdlib.h"
+typedef struct { struct { io_rw_32 csr, div, ctr, cc, top; } slice[8]; } pwm_hw_t;
+extern pwm_hw_t *pwm_hw;
+uint pwm_gpio_to_slice_num(uint gpio);
+uint pwm_gpio_to_channel(uint gpio);
+void pwm_set_clkdiv_int_frac(uint slice, uint8_t integer, uint8_t fract);
+void pwm_set_wrap(uint slice, uint16_t wrap);
+void pwm_set_enabled(uint slice, bool enabled);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+#endif
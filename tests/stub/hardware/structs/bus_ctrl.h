@@ -0,0 +1,7 @@
+#ifndef __STUB_HARDWARE_BUS_CTRL_H__
+#define __STUB_HARDWARE_BUS_CTRL_H__
+#include "pico/stdlib.h"
+typedef struct { io_rw_32 priority; } bus_ctrl_hw_t;
+extern bus_ctrl_hw_t *bus_ctrl_hw;
+#define BUSCTRL_BUS_PRIORITY_PROC1_BITS	0x10
+#endif
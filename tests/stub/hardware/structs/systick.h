@@ -0,0 +1,6 @@
+#ifndef __STUB_HARDWARE_SYSTICK_H__
+#define __STUB_HARDWARE_SYSTICK_H__
+#include "pico/stdlib.h"
+typedef struct { io_rw_32 csr, rvr, cvr; io_ro_32 calib; } systick_hw_t;
+extern systick_hw_t *systick_hw;
+#endif
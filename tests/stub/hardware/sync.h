@@ -0,0 +1,5 @@
+#ifndef __STUB_HARDWARE_SYNC_H__
+#define __STUB_HARDWARE_SYNC_H__
+#include "pico/stdlib.h"
+void __dmb(void);
+#endif
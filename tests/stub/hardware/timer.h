@@ -0,0 +1,5 @@
+#ifndef __STUB_HARDWARE_TIMER_H__
+#define __STUB_HARDWARE_TIMER_H__
+#include "pico/stdlib.h"
+uint32_t time_us_32(void);
+#endif
@@ -0,0 +1,5 @@
+#ifndef __STUB_PICO_MULTICORE_H__
+#define __STUB_PICO_MULTICORE_H__
+#include "pico/stdlib.h"
+void multicore_launch_core1(void (*entry)(void));
+#endif
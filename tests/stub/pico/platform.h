@@ -0,0 +1,4 @@
+#ifndef __STUB_PICO_PLATFORM_H__
+#define __STUB_PICO_PLATFORM_H__
+#include "pico/stdlib.h"
+#endif
@@ -0,0 +1,8 @@
+#ifndef __STUB_PICO_SEM_H__
+#define __STUB_PICO_SEM_H__
+#include "pico/stdlib.h"
+typedef struct { int n; } semaphore_t;
+void sem_init(semaphore_t *s, int16_t initial, int16_t max);
+bool sem_release(semaphore_t *s);
+void sem_acquire_blocking(semaphore_t *s);
+#endif
@@ -0,0 +1,33 @@
+#ifndef __STUB_PICO_STDLIB_H__
+#define __STUB_PICO_STDLIB_H__
+/*
+ * Host stand-in for the Pico SDK, for the tests in this directory only
+ * Just enough declarations to compile the DSP sources with the native compiler.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+typedef volatile uint32_t io_rw_32;
+typedef volatile uint32_t io_ro_32;
+
+#define __not_in_flash_func(f)	f
+#define MAX(a, b)				((a)>(b)?(a):(b))
+#define MIN(a, b)				((a)<(b)?(a):(b))
+
+#define GPIO_OUT				1
+#define GPIO_FUNC_PWM			4
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_set_function(uint gpio, uint fn);
+void gpio_pull_up(uint gpio);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+
+#endif
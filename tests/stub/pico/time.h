@@ -0,0 +1,5 @@
+#ifndef __STUB_PICO_TIME_H__
+#define __STUB_PICO_TIME_H__
+#include "pico/stdlib.h"
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+/*
+ * test.h
+ *
+ * Created: Oct 2026
+ *
+ * Helpers for the host tests, see CMakeLists.txt in this directory.
+ * A test prints one line per check, and returns non-zero when any check failed.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+static int test_fail __attribute__((unused)) = 0;							// Failed checks, not used by the benchmark
+
+/* Check a condition, report it with a printf style message */
+#define CHECK(cond, ...) \
+	do { \
+		printf("%s: ", (cond) ? "pass" : "FAIL"); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		if (!(cond)) test_fail++; \
+	} while (0)
+
+#define TEST_END()	(printf("%s\n", test_fail ? "FAILED" : "OK"), test_fail ? 1 : 0)
+
+/* Deterministic pseudo random numbers, uniform in [-a, a] */
+static uint32_t test_seed = 12345;
+static inline int test_rand(int a)
+{
+	test_seed = test_seed*1664525 + 1013904223;
+	return (int)((int64_t)(test_seed>>8) * (2*a+1) / (1<<24)) - a;
+}
+
+/* Ratio in dB of two powers */
+static inline double test_db(double p, double ref)
+{
+	return 10.0*log10((p + 1e-30)/(ref + 1e-30));
+}
+
+/*
+ * Power of a real signal x[0..n-1] at frequency f, relative to the sample rate fs.
+ * Hann windowed, so a sine of amplitude A reads A^2/2 when f is within a bin of the tone.
+ */
+static inline double test_tone(const double *x, int n, double f, double fs)
+{
+	double re = 0, im = 0, w = 0, h, p;
+	int k;
+
+	for (k=0; k<n; k++)
+	{
+		h = 0.5 - 0.5*cos(2*M_PI*k/n);
+		p = 2*M_PI*f*k/fs;
+		re += h*x[k]*cos(p);
+		im -= h*x[k]*sin(p);
+		w += h;
+	}
+	return 2.0*(re*re + im*im)/(w*w);
+}
+
+/*
+ * Power of a complex signal x + jy at frequency f, which may be negative
+ */
+static inline double test_ctone(const double *x, const double *y, int n, double f, double fs)
+{
+	double re = 0, im = 0, w = 0, h, p, c, s;
+	int k;
+
+	for (k=0; k<n; k++)
+	{
+		h = 0.5 - 0.5*cos(2*M_PI*k/n);
+		p = 2*M_PI*f*k/fs;
+		c = cos(p); s = sin(p);
+		re += h*(x[k]*c + y[k]*s);
+		im += h*(y[k]*c - x[k]*s);
+		w += h;
+	}
+	return (re*re + im*im)/(w*w);
+}
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * test_decim.c
+ *
+ * Created: Oct 2026
+ *
+ * Host test of decim.c, for each output rate S_RATE<<rate, rate 0..DEC_NRATE-1
+ * - Passband: a tone of known amplitude must come out 8x, within +/-0.6dB up to 0.44*fs
+ * - Alias rejection: tones at m*fs+/-f, that fold onto f in the passband, must be suppressed
+ *   by alias_min[rate]
+ * - Overflow: the worst case input for the chain, full ADC range with the signs of the impulse
+ *   response, must saturate and not wrap around the int16 output, also with the DC off center
+ * Only channel 0 carries the test signal, the other two are at the bias level.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "pico/stdlib.h"
+#include "decim.h"
+
+#define F_ADC		125000				// Conversion rate per channel
+#define S_RATE		15625
+#define BIAS		2048				// Nominal ADC DC level
+#define AMP			1000				// Test tone amplitude, ADC LSB
+#define RIPPLE		0.6					// dB
+#define NOUT		4096				// Output samples per measurement
+#define NSETTLE		512					// Output samples skipped
+#define NHMAX		1024				// Max length of the impulse response, ADC samples
+
+static int rate, nblk, dec;				// Output block size, ADC samples per output sample
+static int dc = BIAS;					// ADC DC level
+static uint16_t adc[(NOUT+NSETTLE)*DEC_RATIO*DEC_NCH];
+static int16_t  out[DEC_NCH][NOUT+NSETTLE];
+static double   y[NOUT];
+static double   h[NHMAX];
+
+/* Alias rejection per rate, at 31.25kSps only the CIC rejects the band around 62.5kHz */
+const double alias_min[DEC_NRATE] = {50.0, 44.0, 60.0};
+
+/*
+ * Run the decimator over n output samples of channel 0 input x[], in blocks of blk output samples
+ * The DC bias is only updated between blocks.
+ */
+static void run(const double *x, int n, int blk)
+{
+	int i, c;
+	int16_t *op[DEC_NCH];
+
+	for (i=0; i<n*dec; i++)
+	{
+		adc[DEC_NCH*i] = (uint16_t)lrint(x[i]);
+		for (c=1; c<DEC_NCH; c++) adc[DEC_NCH*i+c] = dc;
+	}
+	dec_init(dc, rate);
+	for (i=0; i<n; i+=blk)
+	{
+		for (c=0; c<DEC_NCH; c++) op[c] = &out[c][i];
+		dec_block(&adc[i*dec*DEC_NCH], blk, op);
+	}
+}
+
+/* Output power of channel 0 at frequency fo, for an input tone at fi */
+static double tone(double fi, double fo)
+{
+	static double x[(NOUT+NSETTLE)*DEC_RATIO];
+	double fs;
+	int i;
+
+	fs = S_RATE<<rate;
+	for (i=0; i<(NOUT+NSETTLE)*dec; i++)
+		x[i] = BIAS + AMP*cos(2*M_PI*fi*i/F_ADC);
+	run(x, NOUT+NSETTLE, nblk);
+	for (i=0; i<NOUT; i++) y[i] = out[0][NSETTLE+i];
+	return test_tone(y, NOUT, fo, fs);
+}
+
+static void test_pass(void)
+{
+	double fs, f, g, gmin, gmax;
+
+	fs = S_RATE<<rate;
+	gmin = 100; gmax = -100;
+	for (f=fs/128; f<=0.44*fs; f+=fs/128)
+	{
+		g = test_db(tone(f, f), (8.0*AMP)*(8.0*AMP)/2);
+		if (g < gmin) gmin = g;
+		if (g > gmax) gmax = g;
+	}
+	CHECK((gmin > -RIPPLE) && (gmax < RIPPLE), "rate %d passband 0..%.0fHz, gain %+.2f..%+.2f dB", rate, 0.44*fs, gmin, gmax);
+}
+
+static void test_alias(void)
+{
+	double fs, f, fi, a, amin, fmin;
+	int m, s;
+
+	fs = S_RATE<<rate;
+	amin = 200; fmin = 0;
+	for (f=fs/64; f<=0.44*fs; f+=fs/64)
+		for (m=1; m*fs-f < F_ADC/2; m++)
+			for (s=-1; s<=1; s+=2)
+			{
+				fi = m*fs + s*f;
+				if (fi >= F_ADC/2) continue;
+				a = test_db((8.0*AMP)*(8.0*AMP)/2, tone(fi, f));
+				if (a < amin) { amin = a; fmin = fi; }
+			}
+	CHECK(amin > alias_min[rate], "rate %d alias rejection %.1f dB, worst at %.0fHz", rate, amin, fmin);
+}
+
+/*
+ * The impulse response from ADC input to output, per phase of the input sample within the
+ * decimation ratio. h[k] is the output per 8 LSB input, k ADC samples after the impulse.
+ * All in one block, so the DC bias does not respond.
+ */
+static int impulse(void)
+{
+	static double x[(NOUT+NSETTLE)*DEC_RATIO];
+	int p, i, k, n, i0, len;
+
+	len = 0;
+	memset(h, 0, sizeof(h));
+	for (p=0; p<dec; p++)
+	{
+		n = NOUT;
+		for (i=0; i<n*dec; i++) x[i] = BIAS;
+		i0 = 64*dec + p;
+		x[i0] = BIAS + AMP;
+		run(x, n, n);
+		for (i=0; i<n; i++)
+		{
+			k = i*dec + dec-1 - i0;											// Output i follows ADC sample i*dec+dec-1
+			if ((k < 0) || (k >= NHMAX)) continue;
+			h[k] = out[0][i]/(8.0*AMP);
+			if ((fabs(h[k]) > 1e-4) && (k >= len)) len = k+1;
+		}
+	}
+	return len;
+}
+
+static void test_overflow(void)
+{
+	static double x[(NOUT+NSETTLE)*DEC_RATIO];
+	double sum, ya, gain;
+	int len, k, i, n, i1, s, wrap;
+	const int dcs[3] = {BIAS, BIAS-512, BIAS+512};
+
+	len = impulse();
+	for (sum=0, gain=0, k=0; k<len; k++) { sum += fabs(h[k]); gain += h[k]; }
+	printf("rate %d impulse response %d taps, DC gain %.3f, sum|h| %.3f\n", rate, len, gain, sum);
+
+	/* Full ADC range with the signs of h, so one output adds up all taps, also with the DC off center */
+	wrap = 0;
+	for (i=0; i<3*2; i++)
+	{
+		dc = dcs[i>>1];
+		s = (i & 1) ? 1 : -1;
+		n = NOUT;
+		i1 = n*dec/2 - 1;													// Output at i1 sees all taps
+		for (k=0; k<n*dec; k++) x[k] = dc;
+		for (k=0; k<len; k++)
+			x[i1-k] = (s*h[k] > 0) ? 4095 : 0;
+		run(x, n, n);
+		for (ya=0, k=0; k<len; k++) ya += 8.0*(x[i1-k] - dc)*h[k];
+		k = out[0][(i1 - (dec-1))/dec];
+		printf("rate %d DC %d %s worst case, expected %.0f, output %d\n", rate, dc, (s > 0) ? "positive" : "negative", ya, k);
+		if ((s > 0) && (k < MIN(ya, 32767)*0.95)) wrap++;
+		if ((s < 0) && (k > MAX(ya, -32768)*0.95)) wrap++;
+	}
+	dc = BIAS;
+	CHECK(wrap == 0, "rate %d worst case input does not wrap", rate);
+}
+
+int main(void)
+{
+	for (rate=0; rate<DEC_NRATE; rate++)
+	{
+		nblk = 64<<rate;													// ADC_BLK<<rate, as the DSP
+		dec = DEC_RATIO>>rate;
+		test_pass();
+		test_alias();
+		test_overflow();
+	}
+	return TEST_END();
+}
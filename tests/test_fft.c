@@ -0,0 +1,198 @@
+/*
+ * test_fft.c
+ *
+ * Created: Oct 2026
+ *
+ * Host test of fix_fft.c and fix_fft_tab.cpp, built per FFT_ORDER and kernel, see CMakeLists.txt
+ * - The generated tables against libm and a plain bit reversal
+ * - fix_fft_n() forward and inverse, at all sizes from 16 points up to FFT_SIZE, against a
+ *   double precision DFT of the same input, scaled by the returned shift
+ * - fix_fft_frame() and fix_fft_real() against the same reference
+ * - A forward and inverse round trip, which must give the input back times FFT_SIZE
+ * The error is given as the SNR of the output against the reference, the limits are about
+ * 10dB below what the 16 bit block floating point kernels reach.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "pico/stdlib.h"
+#include "fix_fft.h"
+
+#define SNR_FWD		60.0				// dB, random input at -12dBFS
+#define SNR_INV		55.0				// dB, random spectrum
+#define SNR_TRIP	50.0				// dB, round trip
+
+static int16_t xr[FFT_SIZE], xi[FFT_SIZE];
+static int16_t in_r[FFT_SIZE], in_i[FFT_SIZE];
+static double  ref_r[FFT_SIZE], ref_i[FFT_SIZE];
+
+#if FFT_STOCKHAM == 1
+static int16_t work[4][FFT_SIZE/2];
+#endif
+
+/* Reference DFT of the input, in double precision */
+static void dft(const int16_t *fr, const int16_t *fi, int n, bool inverse)
+{
+	int k, m;
+	double a, s;
+
+	s = inverse ? 1.0 : -1.0;
+	for (k=0; k<n; k++)
+	{
+		ref_r[k] = 0; ref_i[k] = 0;
+		for (m=0; m<n; m++)
+		{
+			a = s*2*M_PI*(double)((int64_t)k*m % n)/n;
+			ref_r[k] += fr[m]*cos(a) - fi[m]*sin(a);
+			ref_i[k] += fr[m]*sin(a) + fi[m]*cos(a);
+		}
+	}
+}
+
+/* SNR of the output, scaled up by 2^scale, against the reference */
+static double snr(int n, int scale)
+{
+	double ps = 0, pe = 0, g, er, ei;
+	int k;
+
+	g = ldexp(1.0, scale);
+	for (k=0; k<n; k++)
+	{
+		er = xr[k]*g - ref_r[k];
+		ei = xi[k]*g - ref_i[k];
+		ps += ref_r[k]*ref_r[k] + ref_i[k]*ref_i[k];
+		pe += er*er + ei*ei;
+	}
+	return test_db(ps, pe);
+}
+
+static void random_input(int n, int a)
+{
+	int k;
+
+	for (k=0; k<n; k++) { in_r[k] = test_rand(a); in_i[k] = test_rand(a); }
+}
+
+static void test_tables(void)
+{
+	int i, r, err;
+#if FFT_STOCKHAM == 0
+	int b;
+#endif
+
+	err = 0;
+	for (i=0; i<3*FFT_SIZE/4; i++)
+	{
+		r = (int)(32767.0*sin(2*M_PI*i/FFT_SIZE));
+		if (abs(fft_tab.sine[i] - r) > err) err = abs(fft_tab.sine[i] - r);
+	}
+	CHECK(err <= 1, "sine table, max deviation %d LSB from libm", err);
+
+#if FFT_STOCKHAM == 0
+	err = 0;
+	for (i=0; i<FFT_SIZE; i++)
+	{
+		for (r=0, b=0; b<FFT_ORDER; b++)
+			if (i & (1<<b)) r |= 1<<(FFT_ORDER-1-b);
+		if (fft_tab.bitrev[i] != r) err++;
+	}
+	CHECK(err == 0, "bit reverse table, %d wrong entries", err);
+#endif
+}
+
+static void test_sizes(void)
+{
+	int order, n, scale;
+	double s;
+
+	for (order=4; order<=FFT_ORDER; order++)
+	{
+		n = 1<<order;
+
+		random_input(n, 8192);
+		memcpy(xr, in_r, n*sizeof(int16_t)); memcpy(xi, in_i, n*sizeof(int16_t));
+		scale = fix_fft_n(xr, xi, order, false);
+		dft(in_r, in_i, n, false);
+		s = snr(n, scale);
+		CHECK(s > SNR_FWD, "fix_fft_n order %2d forward, SNR %.1f dB", order, s);
+
+		random_input(n, 8192);
+		memcpy(xr, in_r, n*sizeof(int16_t)); memcpy(xi, in_i, n*sizeof(int16_t));
+		scale = fix_fft_n(xr, xi, order, true);
+		dft(in_r, in_i, n, true);
+		s = snr(n, scale);
+		CHECK(s > SNR_INV, "fix_fft_n order %2d inverse, SNR %.1f dB", order, s);
+	}
+}
+
+static void test_frame(void)
+{
+	fft_frame_t f;
+	int k, scale;
+	double s;
+
+	random_input(FFT_SIZE, 8192);
+	f.re[0] = in_r; f.re[1] = in_r + FFT_SIZE/2;
+	f.im[0] = in_i; f.im[1] = in_i + FFT_SIZE/2;
+	scale = fix_fft_frame(xr, xi, &f);
+	dft(in_r, in_i, FFT_SIZE, false);
+	s = snr(FFT_SIZE, scale);
+	CHECK(s > SNR_FWD, "fix_fft_frame, SNR %.1f dB", s);
+
+	/* Real input, even samples in the Re and odd samples in the Im frame */
+	static int16_t ev[FFT_SIZE/2], od[FFT_SIZE/2], zero[FFT_SIZE];
+	for (k=0; k<FFT_SIZE/2; k++) { ev[k] = in_r[2*k]; od[k] = in_r[2*k+1]; }
+	f.re[0] = ev; f.re[1] = ev + FFT_SIZE/4;
+	f.im[0] = od; f.im[1] = od + FFT_SIZE/4;
+	scale = fix_fft_real(xr, xi, &f);
+	dft(in_r, zero, FFT_SIZE, false);
+	s = snr(FFT_SIZE, scale);
+	CHECK(s > SNR_FWD, "fix_fft_real, SNR %.1f dB", s);
+}
+
+static void test_trip(void)
+{
+	int k, s0, s1;
+	double g, ps, pe, e;
+
+	random_input(FFT_SIZE, 8192);
+	memcpy(xr, in_r, sizeof(xr)); memcpy(xi, in_i, sizeof(xi));
+	s0 = fix_fft(xr, xi, false);
+	s1 = fix_fft(xr, xi, true);
+	g = ldexp(1.0, s0+s1)/FFT_SIZE;											// The iFFT has no 1/N
+	ps = 0; pe = 0;
+	for (k=0; k<FFT_SIZE; k++)
+	{
+		e = xr[k]*g - in_r[k]; pe += e*e; ps += (double)in_r[k]*in_r[k];
+		e = xi[k]*g - in_i[k]; pe += e*e; ps += (double)in_i[k]*in_i[k];
+	}
+	e = test_db(ps, pe);
+	CHECK(e > SNR_TRIP, "round trip, SNR %.1f dB", e);
+
+	/* A full scale tone must not overflow */
+	for (k=0; k<FFT_SIZE; k++)
+	{
+		in_r[k] = (int16_t)lrint(32767*cos(2*M_PI*3*k/FFT_SIZE));
+		in_i[k] = (int16_t)lrint(32767*sin(2*M_PI*3*k/FFT_SIZE));
+	}
+	memcpy(xr, in_r, sizeof(xr)); memcpy(xi, in_i, sizeof(xi));
+	s0 = fix_fft(xr, xi, false);
+	dft(in_r, in_i, FFT_SIZE, false);
+	e = snr(FFT_SIZE, s0);
+	CHECK(e > SNR_FWD, "full scale tone, SNR %.1f dB", e);
+}
+
+int main(void)
+{
+	printf("FFT_ORDER %d, %s kernel\n", FFT_ORDER, FFT_STOCKHAM ? "Stockham" : "DIT");
+#if FFT_STOCKHAM == 1
+	fix_fft_work(work[0], work[1], work[2], work[3]);
+#endif
+	test_tables();
+	test_sizes();
+	test_frame();
+	test_trip();
+	return TEST_END();
+}
@@ -0,0 +1,118 @@
+/*
+ * test_iq.c
+ *
+ * Created: Oct 2026
+ *
+ * Host test of the I/Q imbalance correction in dsp.c, iq_balance() and iq_block()
+ * A known gain and phase error is put on the Q channel of a circular test signal, and the image
+ * rejection of a tone is measured on the corrected blocks, as the RX engine would read them:
+ * - IQ_OFF: no correction, the image is at the level the imbalance predicts
+ * - IQ_ADAPT: after convergence the image is at least IRR_MIN down
+ * - IQ_FREEZE: the coefficients stay, also on a non-circular signal, and so does the rejection
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "pico/stdlib.h"
+#include "uSDR.h"
+#include "dsp.h"
+#include "fix_fft.h"
+
+#define BUFSIZE		(FFT_SIZE/2)
+#define GAIN		1.10				// Q gain error, +0.8dB
+#define PHASE		4.0					// Q phase error, degrees
+#define AMP			4000.0				// Test signal amplitude, 8x ADC LSB
+#define F_TONE		0.0713				// Tone frequency, relative to the I/Q rate
+#define NCONV		400					// Blocks to converge
+#define IRR_MIN		40.0				// dB
+
+/* From dsp.c */
+extern int16_t I_buf[3][BUFSIZE], Q_buf[3][BUFSIZE];
+extern volatile int dsp_active, dsp_iqblk;
+extern int dsp_iq;
+extern volatile int32_t iq_a, iq_b;
+void iq_balance(void);
+
+static double ti[BUFSIZE*8], tq[BUFSIZE*8];
+static uint32_t t0;						// Sample count
+
+/*
+ * Next block of the test signal into the newest I/Q buffer, then correct it.
+ * type 0: complex noise, 1: complex tone at F_TONE, 2: real tone on the I=Q diagonal (not circular)
+ * The corrected block is appended to ti/tq at offset k.
+ */
+static void block(int type, int k)
+{
+	int b, i;
+	double re, im, p;
+
+	b = dsp_active + 2;
+	if (b > 2) b -= 3;
+	for (i=0; i<dsp_iqblk; i++, t0++)
+	{
+		p = 2*M_PI*F_TONE*t0;
+		switch (type)
+		{
+		case 0:  re = test_rand(AMP); im = test_rand(AMP); break;
+		case 1:  re = AMP*cos(p); im = AMP*sin(p); break;
+		default: re = AMP*cos(p); im = re; break;
+		}
+		I_buf[b][i] = (int16_t)lrint(re);
+		Q_buf[b][i] = (int16_t)lrint(GAIN*(im*cos(PHASE*M_PI/180) + re*sin(PHASE*M_PI/180)));
+	}
+	iq_balance();
+	if (k >= 0)
+		for (i=0; i<dsp_iqblk; i++) { ti[k+i] = I_buf[b][i]; tq[k+i] = Q_buf[b][i]; }
+	if (++dsp_active > 2) dsp_active = 0;
+}
+
+/* Image rejection of the tone, over 8 corrected blocks */
+static double irr(void)
+{
+	int k, n;
+
+	n = 8*dsp_iqblk;
+	for (k=0; k<n; k+=dsp_iqblk) block(1, k);
+	return test_db(test_ctone(ti, tq, n, F_TONE, 1.0), test_ctone(ti, tq, n, -F_TONE, 1.0));
+}
+
+int main(void)
+{
+	int k;
+	int32_t a, b;
+	double r, g, e;
+
+	/* Expected image level without correction */
+	g = GAIN; e = PHASE*M_PI/180;
+	r = 10*log10((1 + 2*g*cos(e) + g*g)/(1 - 2*g*cos(e) + g*g));
+
+	dsp_iq = IQ_OFF;
+	for (k=0; k<4; k++) block(0, -1);
+	e = irr();
+	CHECK((iq_a == 0) && (iq_b == 0) && (fabs(e - r) < 1.0), "IQ_OFF, image rejection %.1f dB, expected %.1f dB", e, r);
+
+	dsp_iq = IQ_ADAPT;
+	for (k=0; k<NCONV; k++) block(0, -1);
+	e = irr();
+	CHECK(e > IRR_MIN, "IQ_ADAPT on noise, image rejection %.1f dB, a=%d b=%d", e, (int)iq_a, (int)iq_b);
+	for (k=0; k<NCONV; k++) block(1, -1);
+	e = irr();
+	CHECK(e > IRR_MIN, "IQ_ADAPT on a tone, image rejection %.1f dB, a=%d b=%d", e, (int)iq_a, (int)iq_b);
+
+	dsp_iq = IQ_FREEZE;
+	a = iq_a; b = iq_b;
+	for (k=0; k<NCONV; k++) block(2, -1);
+	e = irr();
+	CHECK((iq_a == a) && (iq_b == b) && (e > IRR_MIN), "IQ_FREEZE on a non-circular signal, image rejection %.1f dB", e);
+
+	dsp_iq = IQ_ADAPT;
+	for (k=0; k<NCONV; k++) block(2, -1);
+	CHECK((iq_a != a) || (iq_b != b), "IQ_ADAPT on a non-circular signal moves the coefficients, a=%d b=%d", (int)iq_a, (int)iq_b);
+
+	dsp_iq = IQ_OFF;
+	block(0, -1);
+	CHECK((iq_a == 0) && (iq_b == 0), "IQ_OFF resets the coefficients");
+	return TEST_END();
+}
@@ -0,0 +1,308 @@
+/*
+ * test_rx.c
+ *
+ * Created: Oct 2026
+ *
+ * Host test of the RX branch of the FFT engine in dsp_fft.c, rx() block by block at each rate
+ * The I/Q queue is filled with test tones around Fc, the audio is taken from the audio DAC blocks.
+ * - Sidebands: the audio of a tone in the wanted sideband, against the same audio frequency from
+ *   the opposite sideband, and from I/Q tones at +/-f that a missed bin of the sideband shift
+ *   would pass as is. Above BIN_FC/2, where the in-place shifts overlap their source bins, and
+ *   in the upper flank of the bandpass. The audio image at S_RATE/2-f of the RATE_15 interpolator.
+ * - Pruned FFT: the bins the bandpass passes, flanks included, must equal those of the full FFT,
+ *   for each mode, flank length and with the flat mask of SHED_MASK. The scaling depends only on
+ *   the input, so they are bit exact.
+ * - Spectrum export: after the ring filled up unread, its frames are stale and not returned,
+ *   the next block gives the newest frame
+ * - Auto-notch: a steady carrier in the passband of USB, LSB and AM (either sideband) is removed
+ * - Channels: a USB and a LSB channel as one pair, on the same carrier below Fc. The audio of a
+ *   tone in either passband must have the level of a main receiver tone, and be absent from the
+ *   other channel of the pair.
+ * - NCO: with a fine tuning offset d, a tone at Fc+d+f must give the audio of a tone at Fc+f
+ *   without it, and no audio at f+d.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "pico/stdlib.h"
+#include "uSDR.h"
+#include "dsp.h"
+#include "fix_fft.h"
+
+#define BUFSIZE		(FFT_SIZE/2)
+#define S_RATE		15625
+#define FC			(S_RATE/4.0)		// FC_OFFSET, as BIN_FC at every rate
+#define AMP			2000.0				// Tone amplitude, 8x ADC LSB
+#define NBLK		96					// Blocks per run, the second half is measured
+#define NOTCH_MIN	12.0				// dB, the taper is 5 bins and the tones are not on a bin
+#define SIDE_MIN	40.0				// dB, unwanted sideband and leftover bins
+#define IMAGE_MIN	50.0				// dB, audio image at S_RATE/2-f, of the interpolation at RATE_15
+#define GAIN_DEV	1.0					// dB, passband gain against 1kHz, relative to the mask gain
+#define XTALK_MIN	40.0				// dB, audio of one channel in the other of its pair
+
+/* From dsp.c */
+#define SHED_NONE	0
+#define SHED_MASK	2
+extern int16_t I_buf[3][BUFSIZE], Q_buf[3][BUFSIZE];
+extern uint16_t dac_abuf[2][BUFSIZE];
+extern volatile int dac_play, dsp_active, dsp_rate;
+extern volatile int dsp_shed;
+extern int dsp_mode, dsp_notch, dsp_flank;
+extern int fft_bin[5];
+extern fft_prune_t rx_prune;
+extern volatile uint32_t spec_seq;
+extern int dsp_chan[CHAN_MAX], dsp_choff[CHAN_MAX];
+extern int16_t ch_aud[CHAN_MAX][BUFSIZE];
+extern int ch_scale[CHAN_MAX/2];
+extern int32_t nco_step[2];
+extern uint32_t nco_ph[2];
+bool rx(void);
+void rx_pruneset(void);
+
+static double au[NBLK*BUFSIZE], ca[2][NBLK*BUFSIZE];
+static int na;
+
+/*
+ * Run rx() over NBLK blocks of I/Q input with up to 3 tones, at offsets f[] in Hz from Fc with
+ * amplitudes a[]. The audio output is collected in au[0..na-1], without DC, and the audio of the
+ * first channel pair in ca[][0..na-1], at the iFFT scale of the main receiver.
+ */
+static void run(int mode, int rate, const double *f, const double *a, int n)
+{
+	int b, i, k, act;
+	uint32_t t;
+	double re, im, p, m;
+
+	dsp_mode = mode;
+	dsp_rate = rate;
+	t = 0; act = 0; na = 0;
+	for (b=0; b<NBLK; b++)
+	{
+		for (i=0; i<BUFSIZE; i++, t++)
+		{
+			re = 0; im = 0;
+			for (k=0; k<n; k++)
+			{
+				p = 2*M_PI*(FC + f[k])*t/(S_RATE<<rate);
+				re += a[k]*cos(p); im += a[k]*sin(p);
+			}
+			I_buf[act][i] = (int16_t)lrint(re); Q_buf[act][i] = (int16_t)lrint(im);
+		}
+		if (++act > 2) act = 0;
+		dsp_active = act;													// The filled buffer is now the newest saved one
+		rx();
+		for (i=0; i<(BUFSIZE>>rate); i++, na++)
+		{
+			au[na] = dac_abuf[dac_play^1][i];
+			for (k=0; k<2; k++)
+				ca[k][na] = (ch_scale[0] >= 0) ? ldexp(ch_aud[k][i], ch_scale[0]) : 0;
+		}
+		dac_play ^= 1;
+	}
+	for (m=0, i=na/2; i<na; i++) m += au[i];
+	m /= na - na/2;
+	for (i=0; i<na; i++) au[i] -= m;
+}
+
+/* Audio power at f Hz, over the second half of the run */
+static double level(double f)
+{
+	return test_tone(&au[na/2], na - na/2, f, S_RATE);
+}
+
+/* Audio power at fa of a tone at offset fo from Fc, plus the carrier for AM */
+static double audio(int mode, int rate, double fo, double fa)
+{
+	double f[2], a[2];
+
+	f[0] = fo; a[0] = AMP;
+	f[1] = 0;  a[1] = AMP;
+	run(mode, rate, f, a, (mode == MODE_AM) ? 2 : 1);
+	return level(fa);
+}
+
+/*
+ * Sideband suppression at audio frequency fa, where the mask gain is g dB
+ * The wanted side is +1 USB, -1 LSB, 0 both (AM). The leftover tones are at +/-fa from the
+ * I/Q center, i.e. at offset +/-fa-Fc.
+ */
+static void test_side(int mode, int rate, double fa, double g, const char *name)
+{
+	double p1k, pw, pu, pl, pm, pi, s;
+
+	s = (mode == MODE_USB) ? 1 : ((mode == MODE_LSB) ? -1 : 0);
+	p1k = audio(mode, rate, (s < 0) ? -1000 : 1000, 1000);
+	pw  = audio(mode, rate, (s < 0) ? -fa : fa, fa);
+	CHECK(fabs(test_db(pw, p1k) - g) < GAIN_DEV, "rate %d %s %.0fHz, gain %+.1f dB against 1kHz", rate, name, fa, test_db(pw, p1k));
+	pi = level(S_RATE/2 - fa);
+	CHECK(test_db(pw, pi) > IMAGE_MIN, "rate %d %s %.0fHz, audio image %.1f dB down", rate, name, fa, test_db(pw, pi));
+	if (s != 0)
+	{
+		pu = audio(mode, rate, -s*fa, fa);
+		CHECK(test_db(pw, pu) > SIDE_MIN, "rate %d %s %.0fHz, opposite sideband %.1f dB down", rate, name, fa, test_db(pw, pu));
+	}
+	pl = audio(mode, rate, fa - FC, fa);
+	pm = audio(mode, rate, -fa - FC, fa);
+	CHECK(test_db(pw, MAX(pl, pm)) > SIDE_MIN, "rate %d %s %.0fHz, leftover bins %.1f dB down", rate, name, fa, test_db(pw, MAX(pl, pm)));
+}
+
+/*
+ * Pruned against full FFT of a noise frame, over the bins the bandpass passes and their mirror
+ * The edges are derived here from the bins, flank and shedding level, as dsp_bandpass() uses them.
+ */
+static void test_prune(int mode, int rate, int flank, int shed, const char *name)
+{
+	static int16_t in_r[FFT_SIZE], in_i[FFT_SIZE], fr[FFT_SIZE], fi[FFT_SIZE], pr[FFT_SIZE], pi[FFT_SIZE];
+	fft_frame_t frame;
+	int o, k, e, lo, hi, f2, sf, sp, s, err;
+	const double f0 = 0;
+
+	run(mode, rate, &f0, &f0, 0);											// Bins of the rate
+	dsp_flank = flank; dsp_shed = shed;
+	f2 = (shed >= SHED_MASK) ? 0 : flank/2;
+	lo = MAX(fft_bin[1] - f2, 1);											// BIN_100 and BIN_3000
+	hi = MIN(fft_bin[4] + f2, fft_bin[0] - 1);
+	rx_pruneset();
+	for (k=0; k<FFT_SIZE; k++) { in_r[k] = test_rand(8192); in_i[k] = test_rand(8192); }
+	frame.re[0] = in_r; frame.re[1] = in_r + FFT_SIZE/2;
+	frame.im[0] = in_i; frame.im[1] = in_i + FFT_SIZE/2;
+	sf = fix_fft_frame(fr, fi, &frame);
+	sp = fix_fft_prune(pr, pi, &frame, &rx_prune);
+	s = MAX(sf, sp);
+	err = 0;
+	for (o=-hi; o<=hi; o++)													// Offset from Fc
+	{
+		if ((o > -lo) && (o < lo)) continue;
+		if ((mode == MODE_USB) && (o < 0)) continue;
+		if ((mode == MODE_LSB) && (o > 0)) continue;
+		for (k=0; k<2; k++)
+		{
+			e = (k ? -fft_bin[0]-o : fft_bin[0]+o) & (FFT_SIZE-1);				// Fc+o and its mirror -Fc-o
+			err = MAX(err, abs((fr[e] << (s-sf)) - (pr[e] << (s-sp))));
+			err = MAX(err, abs((fi[e] << (s-sf)) - (pi[e] << (s-sp))));
+		}
+	}
+	dsp_flank = FLANK_DEFAULT; dsp_shed = SHED_NONE;
+	CHECK(err == 0, "rate %d %s flank %d%s, pruned FFT bins %d..%d off by %d", rate, name, flank, (shed >= SHED_MASK) ? " flat" : "", lo, hi, err);
+}
+
+static void test_spec(void)
+{
+	spec_frame_t f;
+	const double f0 = 0;
+	bool stale, fresh;
+
+	run(MODE_USB, 0, &f0, &f0, 0);											// NBLK blocks, the ring is full
+	stale = dsp_getspec(&f);
+	rx();																	// One more block
+	fresh = dsp_getspec(&f);
+	CHECK(!stale && fresh && (f.seq == spec_seq), "spectrum export, stale ring %s, then frame %u of %u",
+		  stale ? "returned" : "skipped", (unsigned)f.seq, (unsigned)spec_seq);
+}
+
+/*
+ * Channel pair on the carrier Fc+d, A as USB and B as LSB, with a main receiver tone at Fc+1kHz
+ * The offset d is a whole nr of bin pairs, as chan_bins() rounds it, so the audio is exactly at 1.5kHz.
+ */
+static void test_chan(int rate)
+{
+	double f[2], a[2], d, pm, pc, pa, pb;
+	int k;
+
+	d = -2*lrint(3500.0*FFT_SIZE/(2*(S_RATE<<rate)))*(double)(S_RATE<<rate)/FFT_SIZE;
+	dsp_chan[0] = MODE_USB; dsp_choff[0] = lrint(d);
+	dsp_chan[1] = MODE_LSB; dsp_choff[1] = lrint(d);
+	f[0] = 1000; a[0] = AMP;
+	a[1] = AMP;
+	for (k=0; k<2; k++)
+	{
+		f[1] = d + (k ? -1500 : 1500);										// In the passband of B or A
+		run(MODE_USB, rate, f, a, 2);
+		pm = level(1000);
+		pc = level(1500);
+		pa = test_tone(&ca[0][na/2], na - na/2, 1500, S_RATE);
+		pb = test_tone(&ca[1][na/2], na - na/2, 1500, S_RATE);
+		CHECK(fabs(test_db(pc, pm)) < GAIN_DEV, "rate %d channel %c at %+.0fHz, gain %+.1f dB against the main receiver",
+			  rate, k ? 'B' : 'A', d, test_db(pc, pm));
+		CHECK(test_db(k ? pb : pa, k ? pa : pb) > XTALK_MIN, "rate %d channel %c, crosstalk into %c %.1f dB down",
+			  rate, k ? 'B' : 'A', k ? 'A' : 'B', test_db(k ? pb : pa, k ? pa : pb));
+	}
+	dsp_chan[0] = CHAN_OFF; dsp_chan[1] = CHAN_OFF;
+}
+
+/* Fine tuning by d Hz, the RX NCO step as nco_derive() sets it */
+static void test_nco(int rate, double d)
+{
+	double f, p0, pw, pu;
+	const double a = AMP;
+
+	f = 1000;
+	run(MODE_USB, rate, &f, &a, 1);
+	p0 = level(1000);
+	nco_step[0] = (int32_t)lrint(-d*4294967296.0/(S_RATE<<rate)); nco_ph[0] = 0;
+	f = d + 1000;
+	run(MODE_USB, rate, &f, &a, 1);
+	pw = level(1000);
+	pu = level(1000 + d);
+	nco_step[0] = 0; nco_ph[0] = 0;
+	CHECK(fabs(test_db(pw, p0)) < GAIN_DEV, "rate %d NCO %+.0fHz, gain %+.1f dB against no offset", rate, d, test_db(pw, p0));
+	CHECK(test_db(pw, pu) > SIDE_MIN, "rate %d NCO %+.0fHz, unshifted tone %.1f dB down", rate, d, test_db(pw, pu));
+}
+
+/* Audio tone of a steady carrier at offset fo from Fc, with the notch off and on */
+static void test_notch(int mode, int rate, double fo, double fa, const char *name)
+{
+	double f[2], a[2], p0, p1;
+	int n;
+
+	f[0] = fo; a[0] = AMP;
+	f[1] = 0;  a[1] = AMP;													// Carrier for AM
+	n = (mode == MODE_AM) ? 2 : 1;
+	dsp_notch = 0;
+	run(mode, rate, f, a, n);
+	p0 = level(fa);
+	dsp_notch = 1;
+	run(mode, rate, f, a, n);
+	p1 = level(fa);
+	dsp_notch = 0;
+	CHECK(test_db(p0, p1) > NOTCH_MIN, "rate %d %s carrier at %+.0fHz, notch %.1f dB", rate, name, fo, test_db(p0, p1));
+}
+
+int main(void)
+{
+	const int flanks[3] = {FLANK_MIN, FLANK_DEFAULT, FLANK_MAX};
+	int rate, k;
+	double bw, fl;
+
+	test_spec();
+	for (rate=0; rate<=2; rate++)
+	{
+		for (k=0; k<3; k++)
+		{
+			test_prune(MODE_USB, rate, flanks[k], SHED_NONE, "USB");
+			test_prune(MODE_LSB, rate, flanks[k], SHED_NONE, "LSB");
+			test_prune(MODE_AM,  rate, flanks[k], SHED_NONE, "AM");
+		}
+		test_prune(MODE_USB, rate, FLANK_DEFAULT, SHED_MASK, "USB");
+		test_prune(MODE_LSB, rate, FLANK_DEFAULT, SHED_MASK, "LSB");
+		test_prune(MODE_AM,  rate, FLANK_DEFAULT, SHED_MASK, "AM");
+		bw = (double)(S_RATE<<rate)/FFT_SIZE;								// Bin width
+		fl = (lrint(3000/bw) + 1)*bw;										// Upper flank, next to BIN_3000
+		test_side(MODE_USB, rate, 2500, 0, "USB");
+		test_side(MODE_USB, rate, fl, -12.0, "USB");
+		test_side(MODE_LSB, rate, 2500, 0, "LSB");
+		test_side(MODE_LSB, rate, fl, -12.0, "LSB");
+		test_side(MODE_AM,  rate, 2500, 0, "AM");
+		test_side(MODE_AM,  rate, fl, -12.0, "AM");
+		test_notch(MODE_USB, rate,  1000, 1000, "USB");
+		test_notch(MODE_LSB, rate, -1000, 1000, "LSB");
+		test_notch(MODE_AM,  rate,  1000, 1000, "AM upper");
+		test_notch(MODE_AM,  rate, -1200, 1200, "AM lower");
+		test_chan(rate);
+		test_nco(rate,  0.8*NCO_WIN(rate));
+		test_nco(rate, -0.8*NCO_WIN(rate));
+	}
+	return TEST_END();
+}
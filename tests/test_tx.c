@@ -0,0 +1,145 @@
+/*
+ * test_tx.c
+ *
+ * Created: Oct 2026
+ *
+ * Host test of the TX branch of the FFT engine in dsp_fft.c, tx() block by block at each rate
+ * The A queue is filled with an audio test tone, the I/Q output is taken from the I/Q DAC blocks.
+ * - Sidebands: for USB, LSB and AM the tone must come out at Fc+f, Fc-f or both, and the opposite
+ *   sideband and the audio bins at +/-f that a missed bin of the sideband shift leaves in place
+ *   must be suppressed by SIDE_MIN. Also in the upper flank of the bandpass, and above BIN_FC/2.
+ * - NCO: with a fine tuning offset d, the tone must come out at Fc+f+d with the level it has at
+ *   Fc+f without it, and nothing must be left at Fc+f.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "pico/stdlib.h"
+#include "uSDR.h"
+#include "dsp.h"
+#include "fix_fft.h"
+
+#define BUFSIZE		(FFT_SIZE/2)
+#define S_RATE		15625
+#define FC			(S_RATE/4.0)		// FC_OFFSET, as BIN_FC at every rate
+#define AMP			4000.0				// Tone amplitude, 8x ADC LSB
+#define AMP_NCO		(AMP/4)				// Tone amplitude of the NCO check, the output must not clip
+#define NBLK		48					// Blocks per run, the second half is measured
+#define SIDE_MIN	40.0				// dB, unwanted sideband and leftover bins
+#define GAIN_DEV	1.0					// dB, output level with an NCO offset against none
+#define DAC_BIAS	128
+
+/* From dsp.c */
+extern int16_t A_buf[3][BUFSIZE];
+extern uint32_t dac_iqbuf[2][BUFSIZE];
+extern volatile int dac_play, dsp_active, dsp_rate;
+extern int dsp_mode;
+extern int32_t nco_step[2];
+extern uint32_t nco_ph[2];
+bool tx(void);
+
+static double ti[NBLK*BUFSIZE], tq[NBLK*BUFSIZE];
+static int nt;
+
+#define A_IDX(t)	(((t)&1)*(BUFSIZE/2) + ((t)>>1))
+
+/*
+ * Run tx() over NBLK blocks of an audio tone at fa with amplitude a, the I/Q output is collected
+ * in ti/tq[0..nt-1] without the DAC bias
+ */
+static void run(int mode, int rate, double fa, double a)
+{
+	int b, i, act;
+	uint32_t t, p;
+
+	dsp_mode = mode;
+	dsp_rate = rate;
+	t = 0; act = 0; nt = 0;
+	for (b=0; b<NBLK; b++)
+	{
+		for (i=0; i<BUFSIZE; i++, t++)
+			A_buf[act][A_IDX(i)] = (int16_t)lrint(a*cos(2*M_PI*fa*t/(S_RATE<<rate)));
+		if (++act > 2) act = 0;
+		dsp_active = act;													// The filled buffer is now the newest saved one
+		tx();
+		for (i=0; i<BUFSIZE; i++, nt++)
+		{
+			p = dac_iqbuf[dac_play^1][i];
+			ti[nt] = (double)(p >> 16) - DAC_BIAS;
+			tq[nt] = (double)(p & 0xffff) - DAC_BIAS;
+		}
+		dac_play ^= 1;
+	}
+}
+
+/* I/Q power at f Hz, over the second half of the run */
+static double level(int rate, double f)
+{
+	return test_ctone(&ti[nt/2], &tq[nt/2], nt - nt/2, f, S_RATE<<rate);
+}
+
+/* Output of an audio tone at fa, the wanted side is +1 USB, -1 LSB, 0 both (AM) */
+static void test_side(int mode, int rate, double fa, const char *name)
+{
+	double pw, pu, pl, s;
+
+	s = (mode == MODE_USB) ? 1 : ((mode == MODE_LSB) ? -1 : 0);
+	run(mode, rate, fa, AMP);
+	pl = MAX(level(rate, fa), level(rate, -fa));
+	if (s != 0)
+	{
+		pw = level(rate, FC + s*fa);
+		pu = level(rate, FC - s*fa);
+		CHECK(test_db(pw, pu) > SIDE_MIN, "rate %d %s %.0fHz, opposite sideband %.1f dB down", rate, name, fa, test_db(pw, pu));
+	}
+	else
+	{
+		pw = level(rate, FC + fa);
+		pu = level(rate, FC - fa);
+		CHECK(fabs(test_db(pw, pu)) < 1.0, "rate %d %s %.0fHz, sidebands %.1f dB apart", rate, name, fa, test_db(pw, pu));
+		pw = MIN(pw, pu);
+	}
+	CHECK(test_db(pw, pl) > SIDE_MIN, "rate %d %s %.0fHz, leftover bins %.1f dB down", rate, name, fa, test_db(pw, pl));
+}
+
+/* Fine tuning by d Hz, the TX NCO step as nco_derive() sets it */
+static void test_nco(int rate, double d)
+{
+	double p0, pw, pu;
+
+	run(MODE_USB, rate, 1000, AMP_NCO);
+	p0 = level(rate, FC + 1000);
+	nco_step[1] = (int32_t)lrint(d*4294967296.0/(S_RATE<<rate)); nco_ph[1] = 0;
+	run(MODE_USB, rate, 1000, AMP_NCO);
+	pw = level(rate, FC + 1000 + d);
+	pu = level(rate, FC + 1000);
+	nco_step[1] = 0; nco_ph[1] = 0;
+	CHECK(fabs(test_db(pw, p0)) < GAIN_DEV, "rate %d NCO %+.0fHz, level %+.1f dB against no offset", rate, d, test_db(pw, p0));
+	CHECK(test_db(pw, pu) > SIDE_MIN, "rate %d NCO %+.0fHz, unshifted tone %.1f dB down", rate, d, test_db(pw, pu));
+}
+
+int main(void)
+{
+	int rate;
+	double bw, fl;
+
+	for (rate=0; rate<=2; rate++)
+	{
+		bw = (double)(S_RATE<<rate)/FFT_SIZE;								// Bin width
+		fl = (lrint(3000/bw) + 1)*bw;										// Upper flank, 0.25 gain
+		test_side(MODE_USB, rate, 1000, "USB");
+		test_side(MODE_USB, rate, 2500, "USB");
+		test_side(MODE_USB, rate, fl,   "USB");
+		test_side(MODE_LSB, rate, 1000, "LSB");
+		test_side(MODE_LSB, rate, 2500, "LSB");
+		test_side(MODE_LSB, rate, fl,   "LSB");
+		test_side(MODE_AM,  rate, 1000, "AM");
+		test_side(MODE_AM,  rate, 2500, "AM");
+		test_side(MODE_AM,  rate, fl,   "AM");
+		test_nco(rate,  0.8*NCO_WIN(rate));
+		test_nco(rate, -0.8*NCO_WIN(rate));
+	}
+	return TEST_END();
+}